@@ -1,10 +1,11 @@
 #!/bin/bash
 
-# 要运行的程序
-PROGRAM="./antivirus_trie_parallel"
+# 要运行的程序及其参数，例如 ./avg_time.sh ./document_trie_parallel --hugepages=off
+PROGRAM="${1:-./antivirus_trie_parallel}"
+shift
 
 # 运行次数
-RUNS=10
+RUNS=${RUNS:-10}
 
 # 总时间初始化为0
 total_time=0
@@ -12,7 +13,7 @@ total_time=0
 # 运行程序并累加时间
 for i in $(seq 1 $RUNS); do
     start_time=$(date +%s.%N)
-    $PROGRAM
+    $PROGRAM "$@"
     end_time=$(date +%s.%N)
     elapsed=$(echo "$end_time - $start_time" | bc)
     total_time=$(echo "$total_time + $elapsed" | bc)
@@ -21,4 +22,4 @@ done
 
 # 计算平均时间
 average_time=$(echo "$total_time / $RUNS" | bc -l)
-echo "Average time: $average_time seconds"
\ No newline at end of file
+echo "Average time: $average_time seconds"
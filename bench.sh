@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# 性能对比实验，用法：./bench.sh <实验名>
+# 每个配置用 avg_time.sh 取平均运行时间（RUNS 控制次数）；若程序以 make PERF=1 编译，
+# 还会额外运行一次并给出 scan 阶段（所有线程合计）的性能计数器。
+
+RUNS=${RUNS:-5}
+export RUNS
+
+# run_case <程序> [参数...]
+run_case() {
+    echo "== $*"
+    ./avg_time.sh "$@" 2>/dev/null | grep "^Average time"
+    PERF_OUTPUT=/tmp/bench_perf.txt "$@" > /dev/null 2>&1
+    if [ -f /tmp/bench_perf.txt ]; then
+        grep -E "^phase|^scan +all" /tmp/bench_perf.txt
+        rm -f /tmp/bench_perf.txt
+    fi
+}
+
+case "$1" in
+    hugepages)
+        # 文本缓冲区与 Trie 结点池使用 4KB 页 / 透明大页 / hugetlb 大页的对比（关注 dtlb_misses）
+        for program in ./document_trie_parallel ./antivirus_trie_parallel; do
+            for policy in off thp 2m; do
+                run_case $program --hugepages=$policy --hugepages-report
+            done
+        done
+        ;;
+    alphabet)
+        # 完整 256 列转移表与字节等价类压缩后的转移表的对比（target.txt 与 virus*.bin 各一组，
+        # --hugepages-report 输出中给出等价类个数与转移表大小）
+        for program in ./document_trie_parallel ./antivirus_trie_parallel; do
+            for alphabet in full classes; do
+                run_case $program --alphabet=$alphabet
+                $program --alphabet=$alphabet --hugepages-report 2>&1 > /dev/null | grep "^trie"
+            done
+        done
+        ;;
+    lanes)
+        # 逐位置 Trie 匹配与稠密 DFA 在 1/2/4/8 条交错子流下的对比
+        for program in ./document_trie_parallel ./antivirus_trie_parallel; do
+            run_case $program --engine=trie
+            for lanes in 1 2 4 8; do
+                run_case $program --lanes=$lanes
+            done
+        done
+        ;;
+    chunks)
+        # 每线程一段的静态划分与不同大小的动态分块任务的对比
+        for chunk in 0 4194304 1048576 262144 65536; do
+            run_case ./document_trie_parallel --chunk-size=$chunk
+        done
+        run_case ./document_trie_parallel --two-pass
+        ;;
+    kernels)
+        # 通用扫描内核与按表布局、换行、查询模式特化的内核的对比（--alphabet=full 时省去等价类查表）
+        for kernel in generic auto; do
+            for mode in all count; do
+                run_case ./document_trie_parallel --kernel=$kernel --mode=$mode
+            done
+            for alphabet in classes full; do
+                run_case ./antivirus_trie_parallel --kernel=$kernel --alphabet=$alphabet
+            done
+        done
+        ;;
+    approx)
+        # 精确匹配与允许 0/1/2 个编辑的近似匹配的对比（同一分块扫描，片段过滤加 Myers 验证）
+        run_case ./document_trie_parallel --mode=count
+        for errors in 0 1 2; do
+            run_case ./document_approx_parallel --errors=$errors --mode=count
+        done
+        ;;
+    *)
+        echo "Usage: $0 hugepages|alphabet|lanes|chunks|kernels|approx"
+        exit 1
+        ;;
+esac
@@ -4,36 +4,35 @@
 #include <vector>
 #include <filesystem>
 #include <omp.h>
+#include "cli.h"
+#include "perf_counters.h"
 #include <algorithm>
 
 namespace fs = std::filesystem;
 
 typedef long long ll;
 
-// Function to perform brute-force string matching
-bool brute_force_search(const std::string& text, const std::string& pattern) {
+// Function to check whether the pattern starts anywhere in text[begin, end); the comparison may
+// read up to pattern.size() - 1 bytes past `end`
+bool brute_force_block(const std::string& text, ll begin, ll end, const std::string& pattern) {
     ll n = text.size();
     ll m = pattern.size();
-    bool found = false;
-
-    #pragma omp parallel for shared(found)
-    for (ll i = 0; i <= n - m; ++i) {
-        if (found) continue;
+    end = std::min(end, n - m + 1);
+    for (ll i = begin; i < end; ++i) {
         ll j = 0;
         while (j < m && text[i + j] == pattern[j]) {
             ++j;
         }
         if (j == m) {
-            #pragma omp critical
-            found = true;
+            return true;
         }
     }
-
-    return found;
+    return false;
 }
 
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -63,10 +62,11 @@ std::vector<std::string> get_all_files(const std::string& directory, const std::
     return files;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 #ifdef VERBOSE
     double start_time = omp_get_wtime();
 #endif
+    Options opts(argc, argv);
     std::string text_directory = "data/software_antivirus/opencv-4.10.0/";
     std::string patterns_directory = "data/software_antivirus/virus/";
 
@@ -74,17 +74,24 @@ int main() {
 
     std::vector<std::string> pattern_files = get_all_files(patterns_directory);
 
-    // Read patterns from the pattern files
+    // Read patterns from the pattern files, empty pattern files are dropped together with their names
     std::vector<std::string> patterns;
+    std::vector<std::string> pattern_names;
     for (const auto& pattern_file : pattern_files) {
         std::string pattern = read_file(pattern_file);
         if (!pattern.empty()) {
             patterns.push_back(pattern);
+            pattern_names.push_back(pattern_file);
         }
     }
 
+    // Files are scanned in L2-sized blocks (--block-size, default 256K): every signature still
+    // pending is tried at all start positions of the block while it is in cache, instead of each
+    // signature streaming the whole file again
+    ll block_size = std::max(1ULL, opts.get_ull("block-size", 256 << 10));
+
     // Parallelize the file reading and pattern matching
-    #pragma omp parallel for
+    #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < text_files.size(); ++i) {
         std::string text = read_file(text_files[i]);
         if (text.empty()) {
@@ -92,9 +99,28 @@ int main() {
         }
 
         std::vector<std::string> matched_patterns;
+        PERF_SCOPE("scan");
+        ll n = text.size();
+        std::vector<bool> found(patterns.size(), false);
+        std::vector<size_t> pending(patterns.size());
+        for (size_t j = 0; j < patterns.size(); ++j) {
+            pending[j] = j;
+        }
+        for (ll begin = 0; begin < n && !pending.empty(); begin += block_size) {
+            ll end = std::min(n, begin + block_size);
+            size_t kept = 0;
+            for (size_t j : pending) {
+                if (brute_force_block(text, begin, end, patterns[j])) {
+                    found[j] = true;
+                } else {
+                    pending[kept++] = j;
+                }
+            }
+            pending.resize(kept);
+        }
         for (size_t j = 0; j < patterns.size(); ++j) {
-            if (brute_force_search(text, patterns[j])) {
-                matched_patterns.push_back(pattern_files[j]);
+            if (found[j]) {
+                matched_patterns.push_back(pattern_names[j]);
             }
         }
 
@@ -114,5 +140,6 @@ int main() {
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include <omp.h>
+#include "perf_counters.h"
+
+namespace fs = std::filesystem;
+
+typedef unsigned long long ull;
+
+// Antivirus scan with the signature automaton compiled into the binary: `make embedded` turns
+// data/software_antivirus/virus/ into build/embedded_signatures.h (see gen_signatures.cpp), whose
+// tables are constexpr and end up in .rodata, so there is nothing to load or build at run time and
+// every process maps the same pages. Built by plain `make` the header is missing and the binary
+// only explains how to generate it.
+#if __has_include("embedded_signatures.h")
+#include "embedded_signatures.h"
+#define HAVE_EMBEDDED_SIGNATURES 1
+#endif
+
+std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::string buffer(size, ' ');
+    if (!file.read(&buffer[0], size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return "";
+    }
+
+    return buffer;
+}
+
+std::vector<std::string> get_all_files(const std::string& directory) {
+    std::vector<std::string> files;
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path().string());
+        }
+    }
+    return files;
+}
+
+// Function to scan `text` with a DFA whose shape is known at compile time: the row stride is a
+// constant, so the index computation folds into a shift or a constant multiply, and the state
+// type is as narrow as the state count allows. Calls on_match(state) on every reporting state
+template <typename State, size_t Classes, State Match, typename OnMatch>
+void scan_embedded(const State* delta, const uint16_t* byte_class, std::string_view text, OnMatch on_match) {
+    PERF_SCOPE("scan");
+    State state = 0;
+    for (unsigned char c : text) {
+        State next = delta[static_cast<size_t>(state) * Classes + byte_class[c]];
+        state = next & static_cast<State>(~Match);
+        if (next & Match) {
+            on_match(state);
+        }
+    }
+}
+
+int main() {
+#ifdef VERBOSE
+    double start_time = omp_get_wtime();
+#endif
+#ifndef HAVE_EMBEDDED_SIGNATURES
+    std::cerr << "antivirus_embedded was built without signatures: run `make embedded`" << std::endl;
+    return 1;
+#else
+    std::string text_directory = "data/software_antivirus/opencv-4.10.0/";
+    std::vector<std::string> text_files = get_all_files(text_directory);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < text_files.size(); ++i) {
+        std::string text = read_file(text_files[i]);
+        if (text.empty()) {
+            continue;
+        }
+        std::vector<bool> matched(embedded::NAME_COUNT, false);
+        scan_embedded<embedded::State, embedded::CLASSES, embedded::MATCH>(embedded::DELTA, embedded::BYTE_CLASS, text, [&](embedded::State state) {
+            for (uint32_t j = embedded::OUTPUT_BEGIN[state]; j < embedded::OUTPUT_BEGIN[state + 1]; ++j) {
+                matched[embedded::OUTPUT[j]] = true;
+            }
+        });
+
+        std::string line;
+        for (size_t name = 0; name < embedded::NAME_COUNT; ++name) {
+            if (matched[name]) {
+                line += " ";
+                line += embedded::NAMES[name];
+            }
+        }
+        if (!line.empty()) {
+            #pragma omp critical
+            {
+                std::cout << text_files[i] << line << std::endl;
+            }
+        }
+    }
+#ifdef VERBOSE
+    double end_time = omp_get_wtime();
+    std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
+#endif
+    PERF_REPORT();
+    return 0;
+#endif
+}
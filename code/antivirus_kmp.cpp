@@ -4,6 +4,7 @@
 #include <vector>
 #include <filesystem>
 #include <omp.h>
+#include "perf_counters.h"
 #include <algorithm>
 
 namespace fs = std::filesystem;
@@ -62,6 +63,7 @@ bool kmp_search(const std::string& text, const std::string& pattern) {
 
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -102,12 +104,14 @@ int main() {
 
     std::vector<std::string> pattern_files = get_all_files(patterns_directory);
 
-    // Read patterns from the pattern files
+    // Read patterns from the pattern files, empty pattern files are dropped together with their names
     std::vector<std::string> patterns;
+    std::vector<std::string> pattern_names;
     for (const auto& pattern_file : pattern_files) {
         std::string pattern = read_file(pattern_file);
         if (!pattern.empty()) {
             patterns.push_back(pattern);
+            pattern_names.push_back(pattern_file);
         }
     }
 
@@ -118,9 +122,10 @@ int main() {
         }
 
         std::vector<std::string> matched_patterns;
+        PERF_SCOPE("scan");
         for (size_t j = 0; j < patterns.size(); ++j) {
             if (kmp_search(text, patterns[j])) {
-                matched_patterns.push_back(pattern_files[j]);
+                matched_patterns.push_back(pattern_names[j]);
             }
         }
 
@@ -136,5 +141,6 @@ int main() {
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
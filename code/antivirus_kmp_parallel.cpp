@@ -4,6 +4,8 @@
 #include <vector>
 #include <filesystem>
 #include <omp.h>
+#include "cli.h"
+#include "perf_counters.h"
 #include <algorithm>
 
 namespace fs = std::filesystem;
@@ -34,34 +36,28 @@ std::vector<int> compute_lps(const std::string& pattern) {
     return lps;
 }
 
-// Function to perform KMP string matching
-bool kmp_search(const std::string& text, const std::string& pattern) {
-    ll n = text.size();
-    ll m = pattern.size();
-    std::vector<int> lps = compute_lps(pattern);
-    int i = 0;
-    int j = 0;
-
-    while (i < n) {
+// Function to advance the KMP state j (length of the matched prefix) over text[begin, end), so a
+// scan can be split into blocks with the state carried from one block to the next; returns
+// pattern.size() as soon as the pattern is found
+int kmp_advance(const std::string& text, ll begin, ll end, const std::string& pattern, const std::vector<int>& lps, int j) {
+    int m = pattern.size();
+    for (ll i = begin; i < end; ++i) {
+        while (j > 0 && pattern[j] != text[i]) {
+            j = lps[j - 1];
+        }
         if (pattern[j] == text[i]) {
             j++;
-            i++;
         }
         if (j == m) {
-            return true; // Pattern found
-        } else if (i < n && pattern[j] != text[i]) {
-            if (j != 0) {
-                j = lps[j - 1];
-            } else {
-                i++;
-            }
+            return j; // Pattern found
         }
     }
-    return false;
+    return j;
 }
 
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -91,10 +87,11 @@ std::vector<std::string> get_all_files(const std::string& directory, const std::
     return files;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 #ifdef VERBOSE
     double start_time = omp_get_wtime();
 #endif    
+    Options opts(argc, argv);
     std::string text_directory = "data/software_antivirus/opencv-4.10.0/";
     std::string patterns_directory = "data/software_antivirus/virus/";
 
@@ -102,15 +99,28 @@ int main() {
 
     std::vector<std::string> pattern_files = get_all_files(patterns_directory);
 
-    // Read patterns from the pattern files
+    // Read patterns from the pattern files, empty pattern files are dropped together with their names
     std::vector<std::string> patterns;
+    std::vector<std::string> pattern_names;
     for (const auto& pattern_file : pattern_files) {
         std::string pattern = read_file(pattern_file);
         if (!pattern.empty()) {
             patterns.push_back(pattern);
+            pattern_names.push_back(pattern_file);
         }
     }
 
+    // The LPS tables are computed once here instead of once per (file, signature)
+    std::vector<std::vector<int>> lps_tables;
+    for (const auto& pattern : patterns) {
+        lps_tables.push_back(compute_lps(pattern));
+    }
+
+    // Files are scanned in L2-sized blocks (--block-size, default 256K): every signature still
+    // pending advances over the block while it is in cache, instead of each signature streaming
+    // the whole file again
+    ll block_size = std::max(1ULL, opts.get_ull("block-size", 256 << 10));
+
     // Parallelize the matching process for each text file
     #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < text_files.size(); ++i) {
@@ -120,9 +130,30 @@ int main() {
         }
 
         std::vector<std::string> matched_patterns;
+        PERF_SCOPE("scan");
+        ll n = text.size();
+        std::vector<int> state(patterns.size(), 0);
+        std::vector<bool> found(patterns.size(), false);
+        std::vector<size_t> pending(patterns.size());
+        for (size_t j = 0; j < patterns.size(); ++j) {
+            pending[j] = j;
+        }
+        for (ll begin = 0; begin < n && !pending.empty(); begin += block_size) {
+            ll end = std::min(n, begin + block_size);
+            size_t kept = 0;
+            for (size_t j : pending) {
+                state[j] = kmp_advance(text, begin, end, patterns[j], lps_tables[j], state[j]);
+                if (state[j] == static_cast<int>(patterns[j].size())) {
+                    found[j] = true;
+                } else {
+                    pending[kept++] = j;
+                }
+            }
+            pending.resize(kept);
+        }
         for (size_t j = 0; j < patterns.size(); ++j) {
-            if (kmp_search(text, patterns[j])) {
-                matched_patterns.push_back(pattern_files[j]);
+            if (found[j]) {
+                matched_patterns.push_back(pattern_names[j]);
             }
         }
 
@@ -141,5 +172,6 @@ int main() {
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
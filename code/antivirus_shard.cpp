@@ -0,0 +1,459 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <filesystem>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <omp.h>
+#include "cli.h"
+#include "dfa.h"
+#include "perf_counters.h"
+#include "signature.h"
+#include "trie.h"
+
+namespace fs = std::filesystem;
+
+typedef unsigned long long ull;
+
+// Multi-process antivirus scan. The coordinator cuts the file list into shards of about
+// --shard-size bytes and hands them to --workers worker processes over Unix sockets; every worker
+// builds the automaton once and answers shard after shard. A worker speaks the protocol on its
+// stdin/stdout, so `antivirus_shard --worker` can as well run on another machine behind any stream.
+// Every message ends with a NUL byte, the one byte a path cannot contain, so file names holding
+// newlines or spaces pass through unchanged:
+//   coordinator -> worker   "S <shard> <n>\0" followed by n paths, each ending in \0 (EOF ends the worker)
+//   worker -> coordinator   "R <path> <virus> ...\0" per infected file, then "D <shard>\0"
+// Results of a shard are only printed once its "D" message arrives, so a shard whose worker dies is
+// simply run again elsewhere: a failed shard is split into single-file shards, and a file that
+// kills a worker twice is reported on stderr and skipped. When nothing is left to hand out, idle
+// workers run a backup copy of shards that take much longer than the average (first answer wins),
+// and --timeout kills a worker stuck on one shard.
+
+std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::string buffer(size, ' ');
+    if (!file.read(&buffer[0], size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return "";
+    }
+
+    return buffer;
+}
+
+std::vector<std::string> get_all_files(const std::string& directory) {
+    std::vector<std::string> files;
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Function to run a worker: build the automaton, then scan the shards arriving on stdin. The
+// signatures are compiled as in antivirus_trie_parallel, *.sig files as wildcard signatures
+int run_worker(const Options& opts) {
+    std::string patterns_directory = opts.get("virus-dir", "data/software_antivirus/virus/");
+    std::vector<std::string> pattern_files = get_all_files(patterns_directory);
+    HugePagePolicy huge_pages = parse_huge_page_policy(opts.get("hugepages", "auto"));
+    Trie trie(huge_pages);
+    std::vector<std::string> signatures(pattern_files.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < pattern_files.size(); ++i) {
+        signatures[i] = read_file(pattern_files[i]);
+    }
+    CompiledSignatures compiled;
+    std::string error;
+    if (!compile_signatures(pattern_files, signatures, compiled, error)) {
+        std::cerr << "Error parsing signature: " << error << std::endl;
+        return 1;
+    }
+    if (opts.get("alphabet", "classes") != "full") {
+        trie.set_alphabet(compiled.patterns);
+    }
+    trie.insert_all(compiled.patterns, omp_get_max_threads(), true);
+    std::vector<std::string>().swap(signatures);
+    ScanOptions scan_options;
+    scan_options.lanes = static_cast<int>(opts.get_ull("lanes", 4));
+    scan_options.positions = !compiled.wildcards.empty(); // offsets only to chain wildcard fragments
+    Dfa dfa(trie, -1, huge_pages);
+    std::string crash_on = opts.get("crash-on", ""); // fault injection for testing the coordinator
+
+    std::string message;
+    while (std::getline(std::cin, message, '\0')) {
+        std::istringstream header(message);
+        std::string tag;
+        ull shard = 0, count = 0;
+        if (!(header >> tag >> shard >> count) || tag != "S") {
+            std::cerr << "worker: bad request: " << message << std::endl;
+            return 1;
+        }
+        std::vector<std::string> files(count);
+        for (auto& file : files) {
+            std::getline(std::cin, file, '\0');
+        }
+
+        std::vector<std::string> results(files.size());
+        #pragma omp parallel
+        {
+            GapChecker checker(compiled);
+            #pragma omp for schedule(dynamic)
+            for (size_t i = 0; i < files.size(); ++i) {
+                if (!crash_on.empty() && files[i].find(crash_on) != std::string::npos) {
+                    std::abort();
+                }
+                std::string text = read_file(files[i]);
+                if (text.empty()) {
+                    continue;
+                }
+                // Identical patterns share one Trie output; fragment hits go to the gap checker
+                std::vector<ull> matched;
+                auto add = [&](ull file) {
+                    if (std::find(matched.begin(), matched.end(), file) == matched.end()) {
+                        matched.push_back(file);
+                    }
+                };
+                checker.begin(supported_lanes(scan_options.lanes) == 1);
+                scan_lanes(scan_options, dfa, text, 0, text.size(), 0, [&](ull index, ull start, int) {
+                    trie.for_each_duplicate(index, [&](ull duplicate) {
+                        if (compiled.is_fragment(duplicate)) {
+                            checker.hit(duplicate, start);
+                        } else {
+                            add(duplicate);
+                        }
+                    });
+                });
+                checker.finish(text.size(), add);
+                for (ull file : matched) {
+                    results[i] += " " + fs::path(pattern_files[file]).filename().string();
+                }
+            }
+        }
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (!results[i].empty()) {
+                std::cout << "R " << files[i] << results[i] << '\0';
+            }
+        }
+        std::cout << "D " << shard << '\0' << std::flush;
+    }
+    PERF_REPORT();
+    return 0;
+}
+
+struct Shard {
+    std::vector<std::string> files;
+    ull bytes = 0;
+    int failures = 0;
+    int running = 0;    // workers currently scanning it (more than one with a backup copy)
+    bool done = false;
+};
+
+struct Worker {
+    pid_t pid = -1;
+    int fd = -1;
+    long shard = -1;    // shard being scanned, -1 when idle
+    double started = 0;
+    bool killed = false;
+    std::string inbox;  // bytes received but not yet split into messages
+    std::string results; // result lines of the current shard
+};
+
+// Function to start a worker process connected through a Unix socket pair
+bool spawn_worker(const std::string& self, const std::vector<std::string>& worker_args, int threads, Worker& worker) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(sv[1], STDIN_FILENO);
+        dup2(sv[1], STDOUT_FILENO);
+        setenv("OMP_NUM_THREADS", std::to_string(threads).c_str(), 1);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(self.c_str()));
+        for (const auto& arg : worker_args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(self.c_str(), argv.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    if (pid < 0) {
+        close(sv[0]);
+        return false;
+    }
+    worker = Worker();
+    worker.pid = pid;
+    worker.fd = sv[0];
+    return true;
+}
+
+bool write_all(int fd, const std::string& data) {
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef VERBOSE
+    double start_time = omp_get_wtime();
+#endif
+    Options opts(argc, argv);
+    if (opts.has("worker")) {
+        return run_worker(opts);
+    }
+    if (opts.has("help")) {
+        std::cout << "Usage: antivirus_shard [--workers=N] [--worker-threads=1] [--shard-size=BYTES] [--timeout=SECONDS]\n"
+                     "                       [--virus-dir=DIR] [--lanes=4] [--alphabet=classes|full] [--hugepages=...]" << std::endl;
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // A broken *.sig would fail every worker the same way, so it is reported here once
+    std::string patterns_directory = opts.get("virus-dir", "data/software_antivirus/virus/");
+    if (!fs::is_directory(patterns_directory)) {
+        std::cerr << "Error opening directory: " << patterns_directory << std::endl;
+        return 1;
+    }
+    for (const auto& path : get_all_files(patterns_directory)) {
+        WildcardSignature signature;
+        std::string error;
+        if (is_wildcard_signature(path) && !parse_signature(read_file(path), signature, error)) {
+            std::cerr << "Error parsing signature: " << path << ": " << error << std::endl;
+            return 1;
+        }
+    }
+    std::string text_directory = "data/software_antivirus/opencv-4.10.0/";
+    std::vector<std::string> text_files = get_all_files(text_directory);
+
+    // Shards are runs of consecutive files of about --shard-size bytes (default: eight shards per
+    // worker, at least 1M), so the work per shard does not depend on how many files it has
+    int workers = static_cast<int>(opts.get_ull("workers", omp_get_num_procs()));
+    workers = std::max(1, workers);
+    std::vector<ull> sizes(text_files.size());
+    ull total_bytes = 0;
+    for (size_t i = 0; i < text_files.size(); ++i) {
+        std::error_code error;
+        sizes[i] = fs::file_size(text_files[i], error);
+        total_bytes += error ? 0 : sizes[i];
+    }
+    ull shard_size = std::max<ull>(1, opts.get_ull("shard-size", std::max<ull>(1 << 20, total_bytes / (8 * workers))));
+    std::vector<Shard> shards;
+    for (size_t i = 0; i < text_files.size(); ++i) {
+        if (shards.empty() || shards.back().bytes >= shard_size) {
+            shards.emplace_back();
+        }
+        shards.back().files.push_back(text_files[i]);
+        shards.back().bytes += sizes[i];
+    }
+    std::deque<long> pending;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        pending.push_back(s);
+    }
+
+    // Workers are this binary in --worker mode, with the scan options passed on
+    char self_path[4096] = {};
+    ssize_t length = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1);
+    std::string self = length > 0 ? std::string(self_path, length) : argv[0];
+    std::vector<std::string> worker_args = {"--worker"};
+    for (const char* key : {"virus-dir", "lanes", "alphabet", "hugepages", "crash-on"}) {
+        if (opts.has(key)) {
+            worker_args.push_back(std::string("--") + key + "=" + opts.get(key, ""));
+        }
+    }
+    int worker_threads = static_cast<int>(std::max<ull>(1, opts.get_ull("worker-threads", 1)));
+    double timeout = opts.get_double("timeout", 0);
+    int respawns = 4 * workers; // replacement workers for the ones that die
+
+    std::vector<Worker> pool(std::min<size_t>(workers, std::max<size_t>(1, shards.size())));
+    for (auto& worker : pool) {
+        if (!spawn_worker(self, worker_args, worker_threads, worker)) {
+            std::cerr << "Error starting worker" << std::endl;
+            return 1;
+        }
+    }
+
+    size_t completed = 0;
+    double shard_seconds = 0; // summed time of the completed shards, for spotting stragglers
+    std::vector<std::string> skipped;
+    auto finish = [&](long s) {
+        shards[s].done = true;
+        completed++;
+    };
+    // A shard whose worker died: split it to isolate the bad file, or give up on a single file
+    // that failed twice
+    auto fail = [&](long s) {
+        Shard& shard = shards[s];
+        shard.running--;
+        if (shard.done || shard.running > 0) {
+            return;
+        }
+        shard.failures++;
+        if (shard.files.size() > 1) {
+            // Counted as done: its single-file shards take its place
+            std::vector<std::string> files = shard.files;
+            finish(s);
+            for (const auto& file : files) {
+                shards.emplace_back();
+                shards.back().files.push_back(file);
+                pending.push_back(shards.size() - 1);
+            }
+        } else if (shard.failures >= 2) {
+            skipped.push_back(shard.files[0]);
+            finish(s);
+        } else {
+            pending.push_front(s);
+        }
+    };
+    auto retire = [&](Worker& worker) {
+        close(worker.fd);
+        waitpid(worker.pid, nullptr, 0);
+        worker.fd = -1;
+        if (worker.shard >= 0) {
+            fail(worker.shard);
+        }
+        worker.shard = -1;
+        if (respawns > 0 && completed < shards.size()) {
+            respawns--;
+            spawn_worker(self, worker_args, worker_threads, worker);
+        }
+    };
+
+    while (completed < shards.size()) {
+        double now = omp_get_wtime();
+        // Hand out work: pending shards first, then backup copies of stragglers
+        for (auto& worker : pool) {
+            if (worker.fd < 0 || worker.shard >= 0) {
+                continue;
+            }
+            long s = -1;
+            if (!pending.empty()) {
+                s = pending.front();
+                pending.pop_front();
+            } else if (completed > 0) {
+                double average = shard_seconds / completed;
+                double slowest = 0;
+                for (const auto& other : pool) {
+                    if (other.fd >= 0 && other.shard >= 0 && !shards[other.shard].done && shards[other.shard].running == 1 &&
+                        now - other.started > std::max(2 * average, 0.05) && now - other.started > slowest) {
+                        s = other.shard;
+                        slowest = now - other.started;
+                    }
+                }
+            }
+            if (s < 0) {
+                continue;
+            }
+            std::string request = "S " + std::to_string(s) + " " + std::to_string(shards[s].files.size()) + '\0';
+            for (const auto& file : shards[s].files) {
+                request += file + '\0';
+            }
+            worker.shard = s;
+            worker.started = now;
+            worker.results.clear();
+            shards[s].running++;
+            if (!write_all(worker.fd, request)) {
+                retire(worker);
+            }
+        }
+
+        bool any_alive = false;
+        std::vector<pollfd> fds;
+        for (const auto& worker : pool) {
+            any_alive = any_alive || worker.fd >= 0;
+            fds.push_back({worker.fd, POLLIN, 0});
+        }
+        if (!any_alive) {
+            std::cerr << "All workers failed, " << shards.size() - completed << " shards left" << std::endl;
+            return 1;
+        }
+        poll(fds.data(), fds.size(), 100);
+
+        for (size_t w = 0; w < pool.size(); ++w) {
+            Worker& worker = pool[w];
+            if (worker.fd < 0) {
+                continue;
+            }
+            if (timeout > 0 && worker.shard >= 0 && !worker.killed && omp_get_wtime() - worker.started > timeout) {
+                worker.killed = true;
+                std::cerr << "worker " << worker.pid << ": shard " << worker.shard << " timed out" << std::endl;
+                kill(worker.pid, SIGKILL);
+            }
+            if (!(fds[w].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            char buffer[1 << 16];
+            ssize_t n = read(worker.fd, buffer, sizeof(buffer));
+            if (n <= 0) {
+                retire(worker);
+                continue;
+            }
+            worker.inbox.append(buffer, n);
+            size_t message_start = 0;
+            for (size_t eom; (eom = worker.inbox.find('\0', message_start)) != std::string::npos; message_start = eom + 1) {
+                std::string message = worker.inbox.substr(message_start, eom - message_start);
+                if (message.rfind("R ", 0) == 0) {
+                    worker.results += message.substr(2) + "\n";
+                } else if (message.rfind("D ", 0) == 0 && worker.shard >= 0) {
+                    // First answer of a shard wins; a backup copy finishing later is dropped
+                    Shard& shard = shards[worker.shard];
+                    shard.running--;
+                    if (!shard.done) {
+                        std::cout << worker.results << std::flush;
+                        shard_seconds += omp_get_wtime() - worker.started;
+                        finish(worker.shard);
+                    }
+                    worker.shard = -1;
+                    worker.results.clear();
+                }
+            }
+            worker.inbox.erase(0, message_start);
+        }
+    }
+
+    // EOF on the sockets ends the idle workers; one still on a copy of a shard that is already
+    // done would only notice after finishing it, so it is killed
+    for (auto& worker : pool) {
+        if (worker.fd >= 0) {
+            if (worker.shard >= 0 && shards[worker.shard].done) {
+                kill(worker.pid, SIGKILL);
+            }
+            close(worker.fd);
+            waitpid(worker.pid, nullptr, 0);
+        }
+    }
+    for (const auto& file : skipped) {
+        std::cerr << "Skipped " << file << ": its worker failed twice" << std::endl;
+    }
+#ifdef VERBOSE
+    double end_time = omp_get_wtime();
+    std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
+#endif
+    PERF_REPORT();
+    return skipped.empty() ? 0 : 2;
+}
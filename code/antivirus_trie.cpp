@@ -5,45 +5,26 @@
 #include <unordered_map>
 #include <filesystem>
 #include <omp.h>
+#include "perf_counters.h"
+#include "trie.h"
 
 namespace fs = std::filesystem;
 
 typedef unsigned long long ull;
 
-struct TrieNode {
-    std::vector<TrieNode*> children;
-    bool isEndOfWord;
-    ull patternIndex;
-
-    TrieNode() : isEndOfWord(false), patternIndex(-1) {
-        children.resize(256, nullptr); // ASCII 字符集
-    }
-};
-
-void insert(TrieNode* root, const std::string& pattern, ull patternIndex) {
-    TrieNode* node = root;
-    for (char ch : pattern) {
-        if (node->children[static_cast<unsigned char>(ch)] == nullptr) {
-            node->children[static_cast<unsigned char>(ch)] = new TrieNode();
-        }
-        node = node->children[static_cast<unsigned char>(ch)];
-    }
-    node->isEndOfWord = true;
-    node->patternIndex = patternIndex;
-}
-
 // Function to search for all patterns in the text using the Trie
-std::unordered_map<ull, std::string> search(const std::string& text, TrieNode* root, const std::vector<std::string>& pattern_files) {
+std::unordered_map<ull, std::string> search(const std::string& text, const Trie& trie, const std::vector<std::string>& pattern_files) {
+    PERF_SCOPE("scan");
     std::unordered_map<ull, std::string> matchedPatterns;
     for (ull i = 0; i < text.size(); ++i) {
-        TrieNode* node = root;
+        uint32_t node = trie.root();
         for (ull j = i; j < text.size(); ++j) {
-            if (node->children[static_cast<unsigned char>(text[j])] == nullptr) {
+            node = trie.next(node, static_cast<unsigned char>(text[j]));
+            if (node == 0) {
                 break;
             }
-            node = node->children[static_cast<unsigned char>(text[j])];
-            if (node->isEndOfWord) {
-                matchedPatterns[node->patternIndex] = pattern_files[node->patternIndex];
+            if (trie.pattern(node) != Trie::NO_PATTERN) {
+                matchedPatterns[trie.pattern(node)] = pattern_files[trie.pattern(node)];
             }
         }
     }
@@ -51,6 +32,7 @@ std::unordered_map<ull, std::string> search(const std::string& text, TrieNode* r
 }
 
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -91,14 +73,14 @@ int main() {
     std::vector<std::string> pattern_files = get_all_files(patterns_directory);
 
     // Initialize the Trie tree
-    TrieNode* root = new TrieNode();
+    Trie trie;
 
-    // Read patterns from the pattern files and insert them into the Trie tree
-    ull patternIndex = 0;
-    for (const auto& pattern_file : pattern_files) {
-        std::string pattern = read_file(pattern_file);
+    // Read patterns from the pattern files and insert them into the Trie tree; the pattern index
+    // is the file index so that empty (skipped) pattern files do not shift the reported names
+    for (size_t i = 0; i < pattern_files.size(); ++i) {
+        std::string pattern = read_file(pattern_files[i]);
         if (!pattern.empty()) {
-            insert(root, pattern, patternIndex++);
+            trie.insert(pattern, i);
         }
     }
 
@@ -109,12 +91,15 @@ int main() {
             continue;
         }
 
-        std::unordered_map<ull, std::string> matchedPatterns = search(text, root, pattern_files);
+        std::unordered_map<ull, std::string> matchedPatterns = search(text, trie, pattern_files);
 
         if (!matchedPatterns.empty()) {
             std::cout << text_files[i];
+            // Identical signatures share one Trie output, which fans out to all of their files
             for (const auto& [index, pattern_file] : matchedPatterns) {
-                std::cout << " " << fs::path(pattern_file).filename().string();
+                trie.for_each_duplicate(index, [&](ull duplicate) {
+                    std::cout << " " << fs::path(pattern_files[duplicate]).filename().string();
+                });
             }
             std::cout << std::endl;
         }
@@ -123,7 +108,8 @@ int main() {
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
-    delete root;
+    trie.clear();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
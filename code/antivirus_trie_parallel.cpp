@@ -5,52 +5,38 @@
 #include <unordered_map>
 #include <filesystem>
 #include <omp.h>
+#include "cli.h"
+#include "dfa.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "signature.h"
+#include "trie.h"
 
 namespace fs = std::filesystem;
 
 typedef unsigned long long ull;
 
-struct TrieNode {
-    std::vector<TrieNode*> children;
-    bool isEndOfWord;
-    ull patternIndex;
-
-    TrieNode() : isEndOfWord(false), patternIndex(-1) {
-        children.resize(256, nullptr); // ASCII 字符集
-    }
-};
-
-void insert(TrieNode* root, const std::string& pattern, ull patternIndex) {
-    TrieNode* node = root;
-    for (char ch : pattern) {
-        if (node->children[static_cast<unsigned char>(ch)] == nullptr) {
-            node->children[static_cast<unsigned char>(ch)] = new TrieNode();
-        }
-        node = node->children[static_cast<unsigned char>(ch)];
-    }
-    node->isEndOfWord = true;
-    node->patternIndex = patternIndex;
-}
-
-// Function to search for all patterns in the text using the Trie
-std::unordered_map<ull, std::string> search(const std::string& text, TrieNode* root, const std::vector<std::string>& pattern_files) {
-    std::unordered_map<ull, std::string> matchedPatterns;
+// Function to search for all patterns in the text using the Trie and call on_match(pattern, start, 0)
+template <typename OnMatch>
+void search(const std::string& text, const Trie& trie, OnMatch on_match) {
+    PERF_SCOPE("scan");
     for (ull i = 0; i < text.size(); ++i) {
-        TrieNode* node = root;
+        uint32_t node = trie.root();
         for (ull j = i; j < text.size(); ++j) {
-            if (node->children[static_cast<unsigned char>(text[j])] == nullptr) {
+            node = trie.next(node, static_cast<unsigned char>(text[j]));
+            if (node == 0) {
                 break;
             }
-            node = node->children[static_cast<unsigned char>(text[j])];
-            if (node->isEndOfWord) {
-                matchedPatterns[node->patternIndex] = pattern_files[node->patternIndex];
+            if (trie.pattern(node) != Trie::NO_PATTERN) {
+                on_match(trie.pattern(node), i, 0);
             }
         }
     }
-    return matchedPatterns;
 }
 
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -69,6 +55,40 @@ std::string read_file(const std::string& filename) {
     return buffer;
 }
 
+// Function to scan a file in windows of buffer.size() bytes with the stream scanner, which carries
+// the automaton state from one window to the next, and call on_match(pattern, start, 0); returns
+// false if the file cannot be read
+template <typename OnMatch>
+bool scan_windowed(const std::string& filename, StreamScanner& scanner, std::string& buffer, Metrics& metrics, ull thread_id,
+                   OnMatch on_match) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    scanner.reset();
+    while (true) {
+        auto read_start = metrics.now();
+        file.read(&buffer[0], buffer.size());
+        std::streamsize n = file.gcount();
+        metrics.add(thread_id, IO_NS, metrics.elapsed_ns(read_start));
+        if (n <= 0) {
+            break;
+        }
+        auto scan_start = metrics.now();
+        scanner.feed(buffer.data(), static_cast<size_t>(n), [&](ull index, ull start) {
+            on_match(index, start, 0);
+        });
+        metrics.add(thread_id, MATCH_NS, metrics.elapsed_ns(scan_start));
+        metrics.add(thread_id, BYTES, n);
+    }
+    if (file.bad()) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
 std::vector<std::string> get_all_files(const std::string& directory, const std::string& extension = "") {
     std::vector<std::string> files;
     for (const auto& entry : fs::recursive_directory_iterator(directory)) {
@@ -79,55 +99,194 @@ std::vector<std::string> get_all_files(const std::string& directory, const std::
     return files;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 #ifdef VERBOSE
     double start_time = omp_get_wtime();
 #endif    
+    Options opts(argc, argv);
     std::string text_directory = "data/software_antivirus/opencv-4.10.0/";
-    std::string patterns_directory = "data/software_antivirus/virus/";
+    std::string patterns_directory = opts.get("virus-dir", "data/software_antivirus/virus/");
+
+    // Progress of the scan (--metrics=stderr|<prometheus file>, every --metrics-interval seconds)
+    Metrics metrics(opts.get("metrics", ""), opts.get_double("metrics-interval", 1), "antivirus_trie_parallel",
+                    omp_get_max_threads());
+    metrics.set_phase("build");
 
     std::vector<std::string> text_files = get_all_files(text_directory);
 
     std::vector<std::string> pattern_files = get_all_files(patterns_directory);
 
-    // Initialize the Trie tree
-    TrieNode* root = new TrieNode();
+    // Initialize the Trie tree on huge pages (--hugepages=off|thp|2m|1g|auto)
+    Trie trie(parse_huge_page_policy(opts.get("hugepages", "auto")));
 
-    // Read patterns from the pattern files and insert them into the Trie tree
-    ull patternIndex = 0;
+    // Read patterns from the pattern files and insert them into the Trie tree; the pattern index
+    // is the file index so that empty (skipped) pattern files do not shift the reported names.
+    // *.sig files are wildcard signatures whose exact fragments are inserted after all files
+    // (see signature.h). Unless --alphabet=full, rows only have columns for the bytes that occur
+    // in some pattern. Files are read and the Trie is built on all threads (Trie::insert_all)
+    std::vector<std::string> signatures(pattern_files.size());
+    #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < pattern_files.size(); ++i) {
-        std::string pattern = read_file(pattern_files[i]);
-        if (!pattern.empty()) {
-            insert(root, pattern, patternIndex++);
+        signatures[i] = read_file(pattern_files[i]);
+    }
+    CompiledSignatures compiled;
+    std::string error;
+    if (!compile_signatures(pattern_files, signatures, compiled, error)) {
+        std::cerr << "Error parsing signature: " << error << std::endl;
+        return 1;
+    }
+    if (opts.get("alphabet", "classes") != "full") {
+        trie.set_alphabet(compiled.patterns);
+    }
+    trie.insert_all(compiled.patterns, omp_get_max_threads(), true);
+    std::vector<std::string>().swap(signatures);
+
+    // By default (--engine=dfa) every file is scanned once by a dense Aho-Corasick DFA in
+    // --lanes=1|2|4|8 interleaved lanes; --engine=trie keeps the per-position Trie walk. Only the
+    // set of matching signatures is needed, so the kernel tracks no offsets unless wildcard
+    // fragments have to be chained (--kernel=generic: the 32-bit class-lookup kernel with offsets,
+    // for comparison)
+    bool use_dfa = opts.get("engine", "dfa") != "trie";
+    ScanOptions scan_options;
+    scan_options.lanes = static_cast<int>(opts.get_ull("lanes", 4));
+    scan_options.positions = !compiled.wildcards.empty();
+    scan_options.generic = opts.get("kernel", "auto") == "generic";
+
+    // --memory-budget=SIZE: the signatures and automata are charged first, then every file has to be
+    // admitted before it is read, waiting for room if need be. The window is --window-size bytes
+    // (default 16M) or an equal share per thread of what the budget leaves, whichever is smaller;
+    // files up to the window are read whole, larger ones are scanned window by window through the
+    // stream scanner, which needs the DFA even with --engine=trie
+    MemoryBudget budget(opts.get_ull("memory-budget", 0));
+    Dfa dfa;
+    if (use_dfa || budget.limited()) {
+        dfa = Dfa(trie, -1, parse_huge_page_policy(opts.get("hugepages", "auto")), !scan_options.generic);
+    }
+    ull pattern_bytes = 0;
+    for (const auto& pattern : compiled.patterns) {
+        pattern_bytes += pattern.capacity();
+    }
+    budget.charge(MEMORY_PATTERNS, pattern_bytes);
+    if (!budget.charge(MEMORY_AUTOMATON, trie.memory_bytes() + dfa.memory_bytes())) {
+        std::cerr << "Memory budget of " << budget.limit() << " bytes is too small for the " << pattern_bytes
+                  << " bytes of signatures and " << trie.memory_bytes() + dfa.memory_bytes() << " bytes of automata" << std::endl;
+        return 1;
+    }
+    ull num_threads = omp_get_max_threads();
+    ull window_size = std::max<ull>(1, std::min(opts.get_ull("window-size", 16 << 20), budget.available() / num_threads));
+    ull windowed_files = 0;
+
+    if (opts.has("hugepages-report")) {
+        std::cerr << "trie: " << trie.distinct_patterns() << " distinct patterns, " << trie.node_count() << " nodes, " << trie.byte_classes() << " byte classes, " << describe_mapping(trie.mapping()) << std::endl;
+        if (use_dfa) {
+            std::cerr << "dfa: " << dfa.state_count() << " states, " << dfa.byte_classes() << " byte classes, " << describe_mapping(dfa.mapping()) << std::endl;
         }
     }
 
     // matching process for each text file
-    #pragma omp parallel for
-    for (size_t i = 0; i < text_files.size(); ++i) {
-        std::string text = read_file(text_files[i]);
-        if (text.empty()) {
-            continue;
-        }
+    metrics.set_tasks(text_files.size());
+    metrics.set_phase("scan");
+    #pragma omp parallel
+    {
+        ull thread_id = omp_get_thread_num();
+        GapChecker checker(compiled);
+        StreamScanner scanner(dfa);
+        #pragma omp for
+        for (size_t i = 0; i < text_files.size(); ++i) {
+            metrics.add(thread_id, TASKS_TAKEN, 1);
+            std::error_code size_error;
+            ull size = fs::file_size(text_files[i], size_error);
+            bool windowed = budget.limited() && !size_error && size > window_size;
+            ull held = windowed ? window_size : (size_error ? 0 : size);
+            budget.acquire(MEMORY_INPUT, held);
 
-        std::unordered_map<ull, std::string> matchedPatterns = search(text, root, pattern_files);
+            // Identical patterns share one Trie output, which fans out to all of their files; the
+            // hits of wildcard fragments go to the gap checker instead
+            std::unordered_map<ull, std::string> matchedPatterns;
+            auto on_match = [&](ull index, ull start, int) {
+                trie.for_each_duplicate(index, [&](ull duplicate) {
+                    if (compiled.is_fragment(duplicate)) {
+                        checker.hit(duplicate, start);
+                    } else {
+                        matchedPatterns[duplicate] = pattern_files[duplicate];
+                    }
+                });
+            };
+            // A single walk reports hits in order, so the gap checker can chain them as they come
+            checker.begin(windowed || !use_dfa || supported_lanes(scan_options.lanes) == 1);
+            bool scanned = false;
+            if (windowed) {
+                std::string window(window_size, '\0');
+                scanned = scan_windowed(text_files[i], scanner, window, metrics, thread_id, on_match);
+                #pragma omp atomic
+                windowed_files++;
+            } else {
+                std::string text;
+                {
+                    MetricTimer timer(metrics, thread_id, IO_NS);
+                    text = read_file(text_files[i]);
+                }
+                size = text.size();
+                scanned = !text.empty();
+                auto scan_start = metrics.now();
+                if (scanned && use_dfa) {
+                    scan_lanes(scan_options, dfa, text, 0, text.size(), 0, on_match);
+                } else if (scanned) {
+                    search(text, trie, on_match);
+                }
+                metrics.add(thread_id, MATCH_NS, metrics.elapsed_ns(scan_start));
+                metrics.add(thread_id, BYTES, text.size());
+            }
+            ull gap_bytes = checker.held_bytes(); // fragment hits kept from interleaved lanes
+            budget.track(MEMORY_RESULTS, gap_bytes);
+            budget.release(MEMORY_INPUT, held);
+            metrics.add(thread_id, FILES, 1);
+            if (!scanned) {
+                checker.finish(0, [](ull) {}); // drops the fragment hits of a partly read file
+                budget.release(MEMORY_RESULTS, gap_bytes);
+                continue;
+            }
+            checker.finish(size, [&](ull file) {
+                matchedPatterns[file] = pattern_files[file];
+            });
+            budget.release(MEMORY_RESULTS, gap_bytes);
+            metrics.add(thread_id, HITS, matchedPatterns.size());
 
-        if (!matchedPatterns.empty()) {
-            #pragma omp critical
-            {
-                std::cout << text_files[i];
-                for (const auto& [index, pattern_file] : matchedPatterns) {
-                    std::cout << " " << fs::path(pattern_file).filename().string();
+            // Result entries are only held until the line is printed
+            ull result_bytes = 0;
+            for (const auto& entry : matchedPatterns) {
+                result_bytes += sizeof(entry) + 2 * sizeof(void*) + entry.second.capacity();
+            }
+            budget.track(MEMORY_RESULTS, result_bytes);
+
+            if (!matchedPatterns.empty()) {
+                #pragma omp critical
+                {
+                    std::cout << text_files[i];
+                    for (const auto& [index, pattern_file] : matchedPatterns) {
+                        std::cout << " " << fs::path(pattern_file).filename().string();
+                    }
+                    std::cout << std::endl;
                 }
-                std::cout << std::endl;
             }
+            budget.release(MEMORY_RESULTS, result_bytes);
         }
     }
+    metrics.set_phase("done");
+    metrics.stop();
+
+    if (opts.has("memory-report")) {
+        std::cerr << "trie: " << trie.node_count() << " nodes, " << trie.memory_bytes() << " bytes; dfa: " << dfa.state_count()
+                  << " states, " << dfa.memory_bytes() << " bytes; " << windowed_files << " files scanned in windows of "
+                  << window_size << " bytes" << std::endl;
+        budget.report(std::cerr);
+    }
 #ifdef VERBOSE
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
-    delete root;
+    trie.clear();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
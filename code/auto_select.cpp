@@ -0,0 +1,516 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <omp.h>
+#include "cli.h"
+#include "suffix_array.h"
+#include "topology.h"
+#include "trie.h"
+
+namespace fs = std::filesystem;
+
+typedef unsigned long long ull;
+
+// Front-end that profiles the workload and runs the engine expected to be fastest on it:
+//   auto_select [document|antivirus] [--calibrate] [--dry-run] [--explain] [engine options...]
+// A fresh suffix-array index of the document is always queried. Otherwise the choice comes from a
+// short calibration run cached per machine when one matches the workload (calibration only times
+// the scanning engines), else from the rules in choose(); engine options (--mode, --k, --lanes, ...)
+// are passed on.
+
+const std::string DOCUMENT_FILE = "data/document_retrieval/document.txt";
+const std::string TARGET_FILE = "data/document_retrieval/target.txt";
+const std::string INDEX_FILE = "data/document_retrieval/document.idx";
+const std::string TEXT_DIRECTORY = "data/software_antivirus/opencv-4.10.0/";
+const std::string VIRUS_DIRECTORY = "data/software_antivirus/virus/";
+
+// Inputs below this many bytes per thread are not worth another thread
+const ull MIN_BYTES_PER_THREAD = 1 << 20;
+
+struct Profile {
+    std::string scenario;
+    // pattern set
+    ull patterns = 0;
+    ull distinct = 0;
+    ull min_length = 0, median_length = 0, max_length = 0;
+    ull alphabet = 0;      // distinct bytes over all patterns
+    double sharing = 0;    // 1 - trie nodes / summed length: how much the patterns share prefixes
+    // input
+    ull input_bytes = 0;
+    ull files = 0;
+    double newline_ratio = 0; // newlines per byte in the first MB of the document
+    bool fresh_index = false;
+    std::string mode = "all";
+};
+
+struct Choice {
+    std::string engine;
+    std::vector<std::string> args;
+    int threads = 1;
+    std::string reason;
+};
+
+std::string read_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::string buffer(size, ' ');
+    if (!file.read(&buffer[0], size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return "";
+    }
+
+    return buffer;
+}
+
+// Function to get all files in a directory recursively, in a stable order
+std::vector<std::string> get_all_files(const std::string& directory) {
+    std::vector<std::string> files;
+    if (!fs::is_directory(directory)) {
+        return files;
+    }
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Function to fill in the pattern statistics of `patterns` (empty ones never match and are skipped)
+void profile_patterns(const std::vector<std::string>& patterns, Profile& profile) {
+    std::vector<ull> lengths;
+    bool used[256] = {};
+    Trie trie(HUGE_OFF);
+    ull total = 0;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if (patterns[i].empty()) {
+            continue;
+        }
+        lengths.push_back(patterns[i].size());
+        total += patterns[i].size();
+        for (char ch : patterns[i]) {
+            used[static_cast<unsigned char>(ch)] = true;
+        }
+        trie.insert(patterns[i], i);
+    }
+    profile.patterns = lengths.size();
+    profile.distinct = trie.distinct_patterns();
+    profile.alphabet = std::count(used, used + 256, true);
+    if (!lengths.empty()) {
+        std::sort(lengths.begin(), lengths.end());
+        profile.min_length = lengths.front();
+        profile.median_length = lengths[lengths.size() / 2];
+        profile.max_length = lengths.back();
+        profile.sharing = 1.0 - static_cast<double>(trie.node_count() - 1) / total;
+    }
+}
+
+// Function to profile the pattern set and sample the input of a scenario; false if the data is missing
+bool profile_workload(const std::string& scenario, const Options& opts, Profile& profile) {
+    profile.scenario = scenario;
+    profile.mode = opts.get("mode", "all");
+    std::vector<std::string> patterns;
+    if (scenario == "document") {
+        std::string target_file = opts.get("targets", TARGET_FILE);
+        std::ifstream targets(target_file);
+        struct stat source;
+        if (!targets.is_open() || stat(DOCUMENT_FILE.c_str(), &source) != 0) {
+            std::cerr << "Error opening file: " << DOCUMENT_FILE << " / " << target_file << std::endl;
+            return false;
+        }
+        std::string pattern;
+        while (std::getline(targets, pattern)) {
+            patterns.push_back(pattern);
+        }
+        profile.input_bytes = source.st_size;
+        profile.files = 1;
+        std::ifstream document(DOCUMENT_FILE, std::ios::binary);
+        std::string sample(std::min<ull>(profile.input_bytes, 1 << 20), '\0');
+        document.read(&sample[0], sample.size());
+        profile.newline_ratio = sample.empty() ? 0 : static_cast<double>(std::count(sample.begin(), sample.end(), '\n')) / sample.size();
+
+        // Same freshness rule as document_index
+        MappedIndex index;
+        profile.fresh_index = index.open(opts.get("index", INDEX_FILE)) &&
+                              index.header().source_size == static_cast<ull>(source.st_size) &&
+                              index.header().source_mtime_ns == static_cast<ull>(source.st_mtim.tv_sec) * 1000000000ULL + source.st_mtim.tv_nsec;
+    } else {
+        for (const auto& file : get_all_files(VIRUS_DIRECTORY)) {
+            patterns.push_back(read_file(file));
+        }
+        for (const auto& file : get_all_files(TEXT_DIRECTORY)) {
+            profile.input_bytes += fs::file_size(file);
+            profile.files++;
+        }
+        if (profile.files == 0) {
+            std::cerr << "Error opening directory: " << TEXT_DIRECTORY << std::endl;
+            return false;
+        }
+    }
+    profile_patterns(patterns, profile);
+    return true;
+}
+
+// Coarse class of a workload: calibration results are reused for every workload of the same class
+std::string workload_key(const Profile& p) {
+    auto log2_bucket = [](ull value) { return value == 0 ? 0 : 64 - __builtin_clzll(value); };
+    std::ostringstream key;
+    key << p.scenario << "/patterns=" << log2_bucket(p.patterns) << "/length=" << log2_bucket(p.median_length)
+        << "/alphabet=" << log2_bucket(p.alphabet) << "/input=" << log2_bucket(p.input_bytes >> 20)
+        << "/files=" << log2_bucket(p.files) << "/mode=" << p.mode;
+    return key.str();
+}
+
+// Identifies the machine (CPU model, hardware threads, host name) a calibration was made on
+std::string machine_key() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line, model = "unknown";
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0) {
+            model = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    std::replace(model.begin(), model.end(), ' ', '_');
+    return std::string(host) + "/" + model + "/" + std::to_string(omp_get_num_procs());
+}
+
+std::string cache_file() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+    std::string base = xdg != nullptr ? xdg : std::string(home != nullptr ? home : "/tmp") + "/.cache";
+    return base + "/parallel-string-matching/auto_select.txt";
+}
+
+std::string join(const std::vector<std::string>& args) {
+    std::string joined;
+    for (const auto& arg : args) {
+        joined += (joined.empty() ? "" : " ") + arg;
+    }
+    return joined;
+}
+
+// Cache lines: machine \t workload \t engine \t threads \t args \t seconds
+bool load_calibration(const std::string& machine, const std::string& workload, Choice& choice) {
+    std::ifstream cache(cache_file());
+    std::string line;
+    bool found = false;
+    while (std::getline(cache, line)) {
+        std::vector<std::string> fields;
+        std::istringstream in(line);
+        std::string field;
+        while (std::getline(in, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() == 6 && fields[0] == machine && fields[1] == workload) {
+            choice.engine = fields[2];
+            choice.threads = std::max(1, std::atoi(fields[3].c_str()));
+            std::istringstream args(fields[4]);
+            choice.args.clear();
+            for (std::string arg; args >> arg;) {
+                choice.args.push_back(arg);
+            }
+            choice.reason = "calibrated on this machine (" + fields[5] + " s on the sample)";
+            found = true; // the last entry wins
+        }
+    }
+    return found;
+}
+
+void save_calibration(const std::string& machine, const std::string& workload, const Choice& choice, double seconds) {
+    std::string path = cache_file();
+    std::vector<std::string> kept;
+    {
+        std::ifstream cache(path);
+        std::string line;
+        while (std::getline(cache, line)) {
+            if (line.rfind(machine + "\t" + workload + "\t", 0) != 0) {
+                kept.push_back(line);
+            }
+        }
+    }
+    std::error_code error;
+    fs::create_directories(fs::path(path).parent_path(), error);
+    std::ofstream cache(path, std::ios::trunc);
+    if (!cache.is_open()) {
+        std::cerr << "Error writing file: " << path << std::endl;
+        return;
+    }
+    for (const auto& line : kept) {
+        cache << line << "\n";
+    }
+    cache << machine << "\t" << workload << "\t" << choice.engine << "\t" << choice.threads << "\t"
+          << join(choice.args) << "\t" << seconds << "\n";
+}
+
+// Threads worth using on `bytes` of input, at most the OpenMP maximum
+int useful_threads(ull bytes) {
+    ull threads = std::max<ull>(1, bytes / MIN_BYTES_PER_THREAD);
+    return static_cast<int>(std::min<ull>(threads, omp_get_max_threads()));
+}
+
+// Function to choose an engine from the profile alone. The rules follow the measurements in the
+// README: the trie engines win overall, parallel KMP loses to parallel brute force on documents and
+// to the serial trie on antivirus, and small inputs do not pay for a thread team
+Choice choose(const Profile& p) {
+    Choice choice;
+    ull l2 = static_cast<ull>(read_sysfs_int("/sys/devices/system/cpu/cpu0/cache/index2/size", 256)) << 10;
+    choice.threads = useful_threads(p.input_bytes);
+    if (p.scenario == "document") {
+        if (p.fresh_index) {
+            choice.engine = "document_index";
+            choice.threads = omp_get_max_threads();
+            choice.reason = "a fresh suffix-array index exists, queries do not rescan the document";
+        } else if (p.patterns <= 2 && p.max_length <= 8 && p.mode != "all") {
+            choice.engine = "document_brute_force_parallel";
+            choice.reason = "one or two short patterns with an early-stopping query mode";
+        } else {
+            // Tasks of about the L2 size; one lane is enough when the whole DFA fits in L1
+            choice.engine = "document_trie_parallel";
+            ull dfa_bytes = (p.max_length * p.patterns + 1) * (p.alphabet + 2) * sizeof(uint32_t);
+            choice.args.push_back("--chunk-size=" + std::to_string(std::max<ull>(64 << 10, l2)));
+            choice.args.push_back(dfa_bytes <= (32 << 10) ? "--lanes=1" : "--lanes=4");
+            choice.reason = "multi-pattern DFA, " + std::to_string(p.distinct) + " distinct patterns";
+        }
+    } else {
+        if (choice.threads == 1 || p.files < 2) {
+            choice.engine = "antivirus_trie";
+            choice.reason = "input too small for a thread team";
+        } else {
+            choice.engine = "antivirus_trie_parallel";
+            choice.threads = static_cast<int>(std::min<ull>(choice.threads, p.files));
+            choice.reason = "multi-pattern DFA over " + std::to_string(p.files) + " files";
+        }
+    }
+    return choice;
+}
+
+// Candidates tried by --calibrate; engines without --mode support only when all positions are wanted
+std::vector<Choice> candidates(const Profile& p) {
+    int max_threads = omp_get_max_threads();
+    std::vector<Choice> list;
+    auto add = [&](const std::string& engine, std::vector<std::string> args, bool parallel) {
+        for (int threads : {1, std::max(1, max_threads / 2), max_threads}) {
+            if (!parallel && threads > 1) {
+                break;
+            }
+            if (!list.empty() && list.back().engine == engine && list.back().args == args && list.back().threads == threads) {
+                continue;
+            }
+            list.push_back({engine, args, threads, ""});
+        }
+    };
+    if (p.scenario == "document") {
+        if (p.mode == "all") {
+            add("document_trie", {}, false);
+        }
+        add("document_brute_force_parallel", {}, true);
+        add("document_kmp_parallel", {}, true);
+        for (const char* chunk : {"--chunk-size=64K", "--chunk-size=256K", "--chunk-size=1M"}) {
+            add("document_trie_parallel", {chunk, "--lanes=4"}, true);
+        }
+        add("document_trie_parallel", {"--chunk-size=256K", "--lanes=1"}, true);
+    } else {
+        add("antivirus_trie", {}, false);
+        add("antivirus_brute_force_parallel", {}, true);
+        add("antivirus_kmp_parallel", {}, true);
+        add("antivirus_trie_parallel", {"--lanes=4"}, true);
+        add("antivirus_trie_parallel", {"--lanes=1"}, true);
+    }
+    return list;
+}
+
+// Function to run `binary` with `args` in `directory` on `threads` threads, output discarded;
+// returns the wall time in seconds, or a negative value if it failed
+double run_timed(const std::string& binary, const std::vector<std::string>& args, const std::string& directory, int threads) {
+    double start = omp_get_wtime();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(directory.c_str()) != 0 || freopen("/dev/null", "w", stdout) == nullptr || freopen("/dev/null", "w", stderr) == nullptr) {
+            _exit(127);
+        }
+        setenv("OMP_NUM_THREADS", std::to_string(threads).c_str(), 1);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return omp_get_wtime() - start;
+}
+
+// Function to build a data/ tree holding a sample of about `bytes` of the input in `directory`:
+// the head of the document, or the first files of the tree (symlinked), with the full pattern set
+bool make_sample(const std::string& scenario, const std::string& directory, ull bytes) {
+    fs::path root = fs::path(directory) / "data";
+    std::error_code error;
+    if (scenario == "document") {
+        fs::create_directories(root / "document_retrieval", error);
+        std::ifstream document(DOCUMENT_FILE, std::ios::binary);
+        std::string sample(std::min<ull>(bytes, fs::file_size(DOCUMENT_FILE)), '\0');
+        document.read(&sample[0], sample.size());
+        std::ofstream out(root / "document_retrieval/document.txt", std::ios::binary);
+        out.write(sample.data(), sample.size());
+        fs::copy_file(TARGET_FILE, root / "document_retrieval/target.txt", error);
+        return static_cast<bool>(out) && !error;
+    }
+    fs::create_directories(root / "software_antivirus", error);
+    fs::create_directory_symlink(fs::absolute(VIRUS_DIRECTORY), root / "software_antivirus/virus", error);
+    ull taken = 0;
+    for (const auto& file : get_all_files(TEXT_DIRECTORY)) {
+        if (taken >= bytes) {
+            break;
+        }
+        fs::path target = root / "software_antivirus/opencv-4.10.0" / fs::relative(file, TEXT_DIRECTORY);
+        fs::create_directories(target.parent_path(), error);
+        fs::create_symlink(fs::absolute(file), target, error);
+        taken += fs::file_size(file);
+    }
+    return !error;
+}
+
+// Function to time every candidate on a sample of the input (best of two runs) and return the
+// fastest; `seconds` is its time
+Choice calibrate(const Profile& p, const std::string& bin_dir, const std::vector<std::string>& passthrough,
+                 ull sample_bytes, double& seconds) {
+    char pattern[] = "/tmp/auto_select.XXXXXX";
+    Choice best = choose(p);
+    seconds = -1;
+    if (mkdtemp(pattern) == nullptr || !make_sample(p.scenario, pattern, sample_bytes)) {
+        std::cerr << "Cannot build the calibration sample, using the rule-based choice" << std::endl;
+        return best;
+    }
+    for (const auto& candidate : candidates(p)) {
+        std::vector<std::string> args = candidate.args;
+        args.insert(args.end(), passthrough.begin(), passthrough.end());
+        double time = -1;
+        for (int run = 0; run < 2; ++run) {
+            double t = run_timed(bin_dir + "/" + candidate.engine, args, pattern, candidate.threads);
+            time = t < 0 ? -1 : (time < 0 ? t : std::min(time, t));
+            if (t < 0) {
+                break;
+            }
+        }
+        std::cerr << "calibrate: " << candidate.engine << (candidate.args.empty() ? "" : " " + join(candidate.args))
+                  << " (" << candidate.threads << " threads): " << (time < 0 ? "failed" : std::to_string(time) + " s") << std::endl;
+        if (time >= 0 && (seconds < 0 || time < seconds)) {
+            seconds = time;
+            best = candidate;
+        }
+    }
+    fs::remove_all(pattern);
+    best.reason = "calibrated on this machine (" + std::to_string(seconds) + " s on the sample)";
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (opts.has("help")) {
+        std::cout << "Usage: auto_select [document|antivirus] [--calibrate] [--sample=8M] [--dry-run] [--explain]\n"
+                     "                   [engine options...]" << std::endl;
+        return 0;
+    }
+    std::string scenario = opts.positional.empty() ? "document" : opts.positional[0];
+    if (scenario != "document" && scenario != "antivirus") {
+        std::cerr << "Unknown scenario: " << scenario << " (document or antivirus)" << std::endl;
+        return 1;
+    }
+
+    // Options of the front-end itself are not passed on to the engine
+    std::vector<std::string> passthrough;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string key = arg.substr(0, arg.find('='));
+        if (arg.rfind("--", 0) == 0 && key != "--calibrate" && key != "--sample" && key != "--dry-run" && key != "--explain") {
+            passthrough.push_back(arg);
+        }
+    }
+    char self[4096] = {};
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    std::string bin_dir = length > 0 ? fs::path(std::string(self, length)).parent_path().string() : ".";
+
+    // Only document_index reads --targets; the scanning engines always read target.txt, so they
+    // would run (and calibrate) on other patterns than the ones profiled
+    if (opts.has("targets") && (scenario != "document" || opts.has("calibrate"))) {
+        std::cerr << "--targets is only honored by document_index, not by the " << scenario
+                  << (opts.has("calibrate") ? " engines that --calibrate times" : " engines") << std::endl;
+        return 1;
+    }
+
+    Profile profile;
+    if (!profile_workload(scenario, opts, profile)) {
+        return 1;
+    }
+    std::string machine = machine_key();
+    std::string workload = workload_key(profile);
+    Choice choice;
+    if (opts.has("calibrate")) {
+        double seconds;
+        choice = calibrate(profile, bin_dir, passthrough, opts.get_ull("sample", 8 << 20), seconds);
+        if (seconds >= 0) {
+            save_calibration(machine, workload, choice, seconds);
+        }
+    } else if (profile.fresh_index || !load_calibration(machine, workload, choice)) {
+        choice = choose(profile);
+    }
+    choice.threads = std::min(choice.threads, omp_get_max_threads());
+    if (opts.has("targets") && choice.engine != "document_index") {
+        std::cerr << "--targets is only honored by document_index, but " << choice.engine << " was chosen ("
+                  << choice.reason << "); build a fresh index with document_index first" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> args = choice.args;
+    args.insert(args.end(), passthrough.begin(), passthrough.end()); // the user's options win
+    if (opts.has("explain") || opts.has("dry-run")) {
+        std::cerr << "profile: " << profile.patterns << " patterns (" << profile.distinct << " distinct), length "
+                  << profile.min_length << "/" << profile.median_length << "/" << profile.max_length
+                  << " min/median/max, " << profile.alphabet << " distinct bytes, prefix sharing " << profile.sharing
+                  << ", " << profile.input_bytes << " input bytes in " << profile.files << " files";
+        if (scenario == "document") {
+            std::cerr << ", newline ratio " << profile.newline_ratio << (profile.fresh_index ? ", fresh index" : "");
+        }
+        std::cerr << "\nworkload: " << workload << "\nchoice: OMP_NUM_THREADS=" << choice.threads << " "
+                  << choice.engine << (args.empty() ? "" : " " + join(args)) << "  (" << choice.reason << ")" << std::endl;
+    }
+    if (opts.has("dry-run")) {
+        return 0;
+    }
+
+    std::string binary = bin_dir + "/" + choice.engine;
+    setenv("OMP_NUM_THREADS", std::to_string(choice.threads).c_str(), 1);
+    std::vector<char*> engine_argv;
+    engine_argv.push_back(const_cast<char*>(binary.c_str()));
+    for (auto& arg : args) {
+        engine_argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    engine_argv.push_back(nullptr);
+    execv(binary.c_str(), engine_argv.data());
+    std::cerr << "Error running " << binary << std::endl;
+    return 1;
+}
@@ -0,0 +1,68 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+
+typedef unsigned long long ull;
+
+// Minimal command-line options: "--key=value", "--flag" (value "1") and positional arguments
+struct Options {
+    std::unordered_map<std::string, std::string> values;
+    std::vector<std::string> positional;
+
+    Options(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+            size_t eq = arg.find('=');
+            if (eq == std::string::npos) {
+                values[arg.substr(2)] = "1";
+            } else {
+                values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        }
+    }
+
+    bool has(const std::string& key) const {
+        return values.count(key) != 0;
+    }
+
+    std::string get(const std::string& key, const std::string& default_value) const {
+        auto it = values.find(key);
+        return it == values.end() ? default_value : it->second;
+    }
+
+    // Accepts plain numbers and the K/M/G binary suffixes, e.g. "--doc-size=300M"
+    ull get_ull(const std::string& key, ull default_value) const {
+        auto it = values.find(key);
+        if (it == values.end() || it->second.empty()) {
+            return default_value;
+        }
+        char* end = nullptr;
+        ull value = std::strtoull(it->second.c_str(), &end, 10);
+        switch (*end) {
+            case 'k': case 'K': value <<= 10; break;
+            case 'm': case 'M': value <<= 20; break;
+            case 'g': case 'G': value <<= 30; break;
+            default: break;
+        }
+        return value;
+    }
+
+    double get_double(const std::string& key, double default_value) const {
+        auto it = values.find(key);
+        if (it == values.end() || it->second.empty()) {
+            return default_value;
+        }
+        return std::strtod(it->second.c_str(), nullptr);
+    }
+};
+
+#endif // CLI_H
@@ -0,0 +1,443 @@
+#ifndef DFA_H
+#define DFA_H
+
+// Aho-Corasick automaton compiled into a dense DFA: every (state, byte class) pair has its
+// transition precomputed, so a scan step is exactly one table load and never follows failure
+// links. A transition into a state that ends some pattern (itself or through a suffix) carries
+// the MATCH bit, so the hot loop only tests the loaded value.
+//
+// A single walk is a chain of dependent loads. scan_lanes() therefore cuts a range into K lanes
+// and steps all of them in lockstep, which keeps K independent loads in flight per thread.
+//
+// Automata with fewer than 2^15 states keep 16-bit entries (MATCH moves to bit 15), which halves
+// the table; with the full alphabet a byte is its own column, so the scan needs no class lookup.
+// The scan kernel is a template over those two table layouts, the lane count, newline skipping
+// and whether match positions are needed at all, and scan_lanes(ScanOptions, ...) picks the
+// instantiation at run time, so every configuration runs a loop without per-byte mode tests.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "huge_pages.h"
+#include "perf_counters.h"
+#include "trie.h"
+
+typedef unsigned long long ull;
+
+class Dfa {
+public:
+    static constexpr uint32_t MATCH = 1u << 31;
+    static constexpr uint16_t MATCH16 = 1u << 15;
+
+    Dfa() = default;
+    Dfa(const Dfa&) = delete;
+    Dfa& operator=(const Dfa&) = delete;
+    Dfa(Dfa&& other) noexcept { *this = std::move(other); }
+    Dfa& operator=(Dfa&& other) noexcept {
+        if (this != &other) {
+            unmap_memory(table_);
+            table_ = other.table_;
+            policy_ = other.policy_;
+            std::memcpy(classes_, other.classes_, sizeof(classes_));
+            stride_ = other.stride_;
+            narrow_ = other.narrow_;
+            byte_indexed_ = other.byte_indexed_;
+            pattern_ = std::move(other.pattern_);
+            output_ = std::move(other.output_);
+            depth_ = std::move(other.depth_);
+            max_depth_ = other.max_depth_;
+            other.table_ = Mapping();
+        }
+        return *this;
+    }
+
+    ~Dfa() {
+        unmap_memory(table_);
+    }
+
+    // Compiles `trie`. A `transparent` byte (e.g. '\n' for the document scan) gets a column that
+    // loops back to the current state without a match, so skipping it needs no branch; the trie
+    // must not use that byte in any pattern, so with the full alphabet the byte keeps its own
+    // (otherwise unused) column. `compact` allows the 16-bit layout.
+    explicit Dfa(const Trie& trie, int transparent = -1, HugePagePolicy policy = HUGE_2M, bool compact = true) : policy_(policy) {
+        PERF_SCOPE("build");
+        size_t trie_stride = trie.byte_classes();
+        // Full alphabet means every byte is its own column; a stride of 256 alone does not say so
+        // (255 used bytes plus the dead column give 256 too)
+        bool full = true;
+        for (int c = 0; c < 256; ++c) {
+            full = full && trie.byte_class(static_cast<unsigned char>(c)) == c;
+        }
+        stride_ = trie_stride + (transparent >= 0 && !full ? 1 : 0);
+        size_t transparent_column = full ? static_cast<size_t>(transparent) : trie_stride;
+        for (int c = 0; c < 256; ++c) {
+            classes_[c] = c == transparent ? static_cast<uint16_t>(transparent_column) : trie.byte_class(static_cast<unsigned char>(c));
+        }
+        byte_indexed_ = full;
+
+        size_t states = trie.node_count();
+        table_ = map_memory(std::max<size_t>(1, states * stride_) * sizeof(uint32_t), policy);
+        if (table_.data == nullptr) {
+            throw std::bad_alloc();
+        }
+        uint32_t* delta = reinterpret_cast<uint32_t*>(table_.data);
+        pattern_.assign(states, Trie::NO_PATTERN);
+        output_.assign(states, 0);
+        depth_.assign(states, 0);
+        std::vector<uint32_t> fail(states, 0);
+
+        // Breadth-first, one level at a time: the failure state of a node is shallower, so its row
+        // and output link are complete before the level of the node starts, and the nodes of one
+        // level are independent of each other. Large levels are split across the threads, which
+        // collect the next level in private lists. The empty pattern (root) never reports
+        std::vector<uint32_t> level = {0}, next_level;
+        while (!level.empty()) {
+            next_level.clear();
+            #pragma omp parallel if (level.size() >= 1024)
+            {
+                std::vector<uint32_t> children;
+                #pragma omp for schedule(dynamic, 256) nowait
+                for (size_t i = 0; i < level.size(); ++i) {
+                    uint32_t u = level[i];
+                    uint32_t* row = delta + static_cast<size_t>(u) * stride_;
+                    const uint32_t* fail_row = delta + static_cast<size_t>(fail[u]) * stride_;
+                    for (size_t cls = 0; cls < trie_stride; ++cls) {
+                        if (transparent >= 0 && cls == transparent_column) {
+                            continue;
+                        }
+                        uint32_t v = trie.child(u, cls);
+                        if (v == 0) {
+                            row[cls] = u == 0 ? 0 : fail_row[cls];
+                            continue;
+                        }
+                        uint32_t f = u == 0 ? 0 : fail_row[cls] & ~MATCH;
+                        fail[v] = f;
+                        depth_[v] = depth_[u] + 1;
+                        pattern_[v] = trie.pattern(v);
+                        output_[v] = pattern_[f] != Trie::NO_PATTERN ? f : output_[f];
+                        row[cls] = v | (pattern_[v] != Trie::NO_PATTERN || output_[v] != 0 ? MATCH : 0);
+                        children.push_back(v);
+                    }
+                    if (transparent >= 0) {
+                        row[transparent_column] = u;
+                    }
+                }
+                #pragma omp critical
+                next_level.insert(next_level.end(), children.begin(), children.end());
+            }
+            if (!next_level.empty()) {
+                max_depth_ = depth_[next_level[0]];
+            }
+            level.swap(next_level);
+        }
+        if (compact && states < MATCH16) {
+            narrow();
+        }
+    }
+
+    // Copy in a fresh mapping, first-touched by the calling thread (NUMA replicas)
+    Dfa clone() const {
+        Dfa copy;
+        copy.policy_ = policy_;
+        copy.table_ = map_memory(table_.size, policy_);
+        if (copy.table_.data == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::memcpy(copy.table_.data, table_.data, table_.size);
+        std::memcpy(copy.classes_, classes_, sizeof(classes_));
+        copy.stride_ = stride_;
+        copy.narrow_ = narrow_;
+        copy.byte_indexed_ = byte_indexed_;
+        copy.pattern_ = pattern_;
+        copy.output_ = output_;
+        copy.depth_ = depth_;
+        copy.max_depth_ = max_depth_;
+        return copy;
+    }
+
+    // Transition entry for byte c: the next state, with MATCH set if it reports something
+    uint32_t step(uint32_t state, unsigned char c) const {
+        size_t index = static_cast<size_t>(state) * stride_ + classes_[c];
+        if (!narrow_) {
+            return rows<uint32_t>()[index];
+        }
+        uint16_t entry = rows<uint16_t>()[index];
+        return (entry & ~MATCH16) | (entry & MATCH16 ? MATCH : 0);
+    }
+
+    // Raw table in its layout (State is uint16_t when narrow(), else uint32_t)
+    template <typename State>
+    const State* rows() const { return reinterpret_cast<const State*>(table_.data); }
+    const uint16_t* class_map() const { return classes_; }
+    bool is_narrow() const { return narrow_; }
+    // Every byte is its own column (full alphabet), so the class lookup can be skipped
+    bool byte_indexed() const { return byte_indexed_; }
+
+    // Calls f(pattern, length) for every pattern ending in `state`, longest first
+    template <typename F>
+    void for_each_match(uint32_t state, F f) const {
+        if (pattern_[state] == Trie::NO_PATTERN) {
+            state = output_[state];
+        }
+        while (state != 0) {
+            f(pattern_[state], static_cast<ull>(depth_[state]));
+            state = output_[state];
+        }
+    }
+
+    ull max_depth() const { return max_depth_; }
+    size_t state_count() const { return pattern_.size(); }
+    size_t byte_classes() const { return stride_; }
+    const Mapping& mapping() const { return table_; }
+    size_t memory_bytes() const {
+        return table_.mapped + pattern_.capacity() * sizeof(ull) + (output_.capacity() + depth_.capacity()) * sizeof(uint32_t);
+    }
+
+private:
+    // Rewrites the table with 16-bit entries into a mapping of half the size
+    void narrow() {
+        size_t entries = state_count() * stride_;
+        Mapping compact = map_memory(std::max<size_t>(1, entries) * sizeof(uint16_t), policy_);
+        if (compact.data == nullptr) {
+            return;
+        }
+        const uint32_t* wide = rows<uint32_t>();
+        uint16_t* entry = reinterpret_cast<uint16_t*>(compact.data);
+        #pragma omp parallel for if (entries >= (1 << 20))
+        for (size_t i = 0; i < entries; ++i) {
+            entry[i] = static_cast<uint16_t>((wide[i] & ~MATCH) | (wide[i] & MATCH ? MATCH16 : 0));
+        }
+        unmap_memory(table_);
+        table_ = compact;
+        narrow_ = true;
+    }
+
+    Mapping table_;
+    HugePagePolicy policy_ = HUGE_2M;
+    uint16_t classes_[256] = {};
+    size_t stride_ = 1;
+    bool narrow_ = false;
+    bool byte_indexed_ = false;
+    std::vector<ull> pattern_;     // pattern ending exactly in the state
+    std::vector<uint32_t> output_; // nearest proper suffix state that ends a pattern, 0 if none
+    std::vector<uint32_t> depth_;  // = length of the pattern ending in the state
+    ull max_depth_ = 0;
+};
+
+// Finds every match that starts in text[begin, end) and calls on_match(pattern, offset, lane), where
+// the offset of text[begin] is `base` and, with SkipNewlines, newlines are not counted (the DFA must
+// then have '\n' as its transparent byte). Matches may run past `end`. Without Positions no offsets
+// are tracked: on_match(pattern, 0, lane) is called for every match found, including those a lane
+// finds in its overlap, which suits callers that only collect the set of matching patterns.
+// State and ByteIndexed must match the layout of the DFA (is_narrow(), byte_indexed()).
+//
+// [begin, end) is split into K lanes that are stepped together. Every lane starts in the root,
+// which finds exactly the matches starting at or after the lane start, and keeps scanning until
+// max_depth - 1 countable bytes past its own end, so that it also completes the matches that
+// start in it but end in the next lane; it only reports those that start inside it. Within a lane,
+// the offsets of each pattern arrive in ascending order.
+template <int K, bool SkipNewlines, bool Positions, bool ByteIndexed, typename State, typename OnMatch>
+void scan_lanes(const Dfa& dfa, std::string_view text, ull begin, ull end, ull base, OnMatch on_match) {
+    constexpr State MATCH_BIT = sizeof(State) == 2 ? Dfa::MATCH16 : Dfa::MATCH;
+    const State* rows = dfa.rows<State>();
+    const uint16_t* classes = dfa.class_map();
+    const size_t stride = ByteIndexed ? 256 : dfa.byte_classes();
+    ull pos[K], limit[K], offset[K], owned_end[K];
+    State state[K];
+    ull lane_size = (end - begin) / K;
+    ull lane_base = base;
+    for (int l = 0; l < K; ++l) {
+        ull lane_begin = begin + l * lane_size;
+        ull lane_end = l == K - 1 ? end : lane_begin + lane_size;
+        ull countable = lane_end - lane_begin;
+        if (SkipNewlines) {
+            countable -= std::count(text.begin() + lane_begin, text.begin() + lane_end, '\n');
+        }
+        pos[l] = lane_begin;
+        state[l] = 0;
+        offset[l] = lane_base;
+        owned_end[l] = lane_base + countable;
+        lane_base += countable;
+
+        // Overlap into the following bytes, skipping newlines that a match would skip as well
+        ull extend = lane_end;
+        if (lane_end > lane_begin) {
+            ull need = dfa.max_depth() > 0 ? dfa.max_depth() - 1 : 0;
+            if (!SkipNewlines) {
+                extend = std::min<ull>(text.size(), lane_end + need);
+            }
+            for (; SkipNewlines && need > 0 && extend < text.size(); ++extend) {
+                need -= text[extend] != '\n';
+            }
+        }
+        limit[l] = extend;
+    }
+
+    auto advance = [&](int l) {
+        unsigned char c = static_cast<unsigned char>(text[pos[l]++]);
+        State next = rows[static_cast<size_t>(state[l]) * stride + (ByteIndexed ? c : classes[c])];
+        if (Positions) {
+            offset[l] += SkipNewlines ? (c != '\n') : 1;
+        }
+        state[l] = static_cast<State>(next & ~MATCH_BIT);
+        if (next & MATCH_BIT) {
+            dfa.for_each_match(state[l], [&](ull pattern, ull length) {
+                if (!Positions) {
+                    on_match(pattern, 0, l);
+                } else if (offset[l] - length < owned_end[l]) {
+                    on_match(pattern, offset[l] - length, l);
+                }
+            });
+        }
+    };
+
+    // All lanes have at least `common` bytes left: step them in lockstep without bounds checks,
+    // then finish the longer ones one by one
+    ull common = limit[0] - pos[0];
+    for (int l = 1; l < K; ++l) {
+        common = std::min(common, limit[l] - pos[l]);
+    }
+    for (ull s = 0; s < common; ++s) {
+        for (int l = 0; l < K; ++l) {
+            advance(l);
+        }
+    }
+    for (int l = 0; l < K; ++l) {
+        while (pos[l] < limit[l]) {
+            advance(l);
+        }
+    }
+}
+
+// Lane counts with a compiled kernel: 1, 2, 4 or 8, anything else falls back to 4
+inline int supported_lanes(int lanes) {
+    return lanes == 1 || lanes == 2 || lanes == 8 ? lanes : 4;
+}
+
+// Run-time choice of the scan kernel
+struct ScanOptions {
+    int lanes = 4;
+    bool skip_newlines = false; // the range (and its overlap) may contain newlines to skip
+    bool positions = true;      // offsets are needed (false: only which patterns occur)
+    bool generic = false;       // always the class-lookup kernel, for comparison
+};
+
+template <bool SkipNewlines, bool Positions, bool ByteIndexed, typename State, typename OnMatch>
+void scan_lanes_of(int lanes, const Dfa& dfa, std::string_view text, ull begin, ull end, ull base, OnMatch on_match) {
+    switch (supported_lanes(lanes)) {
+        case 1: scan_lanes<1, SkipNewlines, Positions, ByteIndexed, State>(dfa, text, begin, end, base, on_match); break;
+        case 2: scan_lanes<2, SkipNewlines, Positions, ByteIndexed, State>(dfa, text, begin, end, base, on_match); break;
+        case 8: scan_lanes<8, SkipNewlines, Positions, ByteIndexed, State>(dfa, text, begin, end, base, on_match); break;
+        default: scan_lanes<4, SkipNewlines, Positions, ByteIndexed, State>(dfa, text, begin, end, base, on_match); break;
+    }
+}
+
+template <bool SkipNewlines, bool Positions, typename OnMatch>
+void scan_lanes_layout(const ScanOptions& options, const Dfa& dfa, std::string_view text, ull begin, ull end, ull base, OnMatch on_match) {
+    bool indexed = dfa.byte_indexed() && !options.generic;
+    if (dfa.is_narrow()) {
+        if (indexed) {
+            scan_lanes_of<SkipNewlines, Positions, true, uint16_t>(options.lanes, dfa, text, begin, end, base, on_match);
+        } else {
+            scan_lanes_of<SkipNewlines, Positions, false, uint16_t>(options.lanes, dfa, text, begin, end, base, on_match);
+        }
+    } else if (indexed) {
+        scan_lanes_of<SkipNewlines, Positions, true, uint32_t>(options.lanes, dfa, text, begin, end, base, on_match);
+    } else {
+        scan_lanes_of<SkipNewlines, Positions, false, uint32_t>(options.lanes, dfa, text, begin, end, base, on_match);
+    }
+}
+
+// Runtime dispatch to the kernel for `options` and the layout of `dfa`. The generic kernel always
+// tracks positions and maps every byte through the class map
+template <typename OnMatch>
+void scan_lanes(const ScanOptions& options, const Dfa& dfa, std::string_view text, ull begin, ull end, ull base, OnMatch on_match) {
+    PERF_SCOPE("scan");
+    if (options.skip_newlines) {
+        scan_lanes_layout<true, true>(options, dfa, text, begin, end, base, on_match);
+    } else if (options.positions || options.generic) {
+        scan_lanes_layout<false, true>(options, dfa, text, begin, end, base, on_match);
+    } else {
+        scan_lanes_layout<false, false>(options, dfa, text, begin, end, base, on_match);
+    }
+}
+
+// Incremental scan of an unbounded stream (a pipe, a socket): the DFA state and the stream offset
+// are carried from one feed() to the next, so a match that spans buffers is found exactly as in a
+// single pass, and nothing of the stream is kept. on_match(pattern, offset) is called as soon as
+// the last byte of a match has been fed, with the offset of its first byte in the whole stream;
+// with skip_newlines newlines are not counted (the DFA must have '\n' as its transparent byte).
+class StreamScanner {
+public:
+    explicit StreamScanner(const Dfa& dfa, bool skip_newlines = false) : dfa_(&dfa), skip_newlines_(skip_newlines) {}
+
+    template <typename OnMatch>
+    void feed(const char* data, size_t size, OnMatch on_match) {
+        PERF_SCOPE("scan");
+        if (skip_newlines_) {
+            feed_layout<true>(data, size, on_match);
+        } else {
+            feed_layout<false>(data, size, on_match);
+        }
+    }
+
+    // Bytes counted so far (the offset the next byte gets)
+    ull offset() const { return offset_; }
+    // Starts a new stream
+    void reset() {
+        state_ = 0;
+        offset_ = 0;
+    }
+
+private:
+    template <bool SkipNewlines, typename OnMatch>
+    void feed_layout(const char* data, size_t size, OnMatch on_match) {
+        bool indexed = dfa_->byte_indexed();
+        if (dfa_->is_narrow()) {
+            if (indexed) {
+                feed_as<SkipNewlines, true, uint16_t>(data, size, on_match);
+            } else {
+                feed_as<SkipNewlines, false, uint16_t>(data, size, on_match);
+            }
+        } else if (indexed) {
+            feed_as<SkipNewlines, true, uint32_t>(data, size, on_match);
+        } else {
+            feed_as<SkipNewlines, false, uint32_t>(data, size, on_match);
+        }
+    }
+
+    template <bool SkipNewlines, bool ByteIndexed, typename State, typename OnMatch>
+    void feed_as(const char* data, size_t size, OnMatch on_match) {
+        constexpr State MATCH_BIT = sizeof(State) == 2 ? Dfa::MATCH16 : Dfa::MATCH;
+        const State* rows = dfa_->rows<State>();
+        const uint16_t* classes = dfa_->class_map();
+        const size_t stride = ByteIndexed ? 256 : dfa_->byte_classes();
+        State state = static_cast<State>(state_);
+        ull offset = offset_;
+        for (size_t i = 0; i < size; ++i) {
+            unsigned char c = static_cast<unsigned char>(data[i]);
+            State next = rows[static_cast<size_t>(state) * stride + (ByteIndexed ? c : classes[c])];
+            offset += SkipNewlines ? (c != '\n') : 1;
+            state = static_cast<State>(next & ~MATCH_BIT);
+            if (next & MATCH_BIT) {
+                dfa_->for_each_match(state, [&](ull pattern, ull length) {
+                    on_match(pattern, offset - length);
+                });
+            }
+        }
+        state_ = state;
+        offset_ = offset;
+    }
+
+    const Dfa* dfa_;
+    bool skip_newlines_;
+    uint32_t state_ = 0;
+    ull offset_ = 0;
+};
+
+#endif // DFA_H
@@ -0,0 +1,281 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <filesystem>
+#include <cstdlib>
+#include <unistd.h>
+#include "cli.h"
+#include "oracle.h"
+
+namespace fs = std::filesystem;
+
+// Small alphabets maximize overlapping and nested matches; the binary alphabet covers NUL and
+// high bytes
+const std::vector<std::string> ALPHABETS = {"ab", "abc", "acgt", "abcdefghijklmnopqrstuvwxyz"};
+
+std::string random_text(std::mt19937_64& rng, const std::string& alphabet, size_t length, bool binary, int newline_percent) {
+    std::string s;
+    for (size_t i = 0; i < length; ++i) {
+        if (static_cast<int>(rng() % 100) < newline_percent) {
+            s.push_back('\n');
+        } else if (binary) {
+            s.push_back(static_cast<char>(rng() % 256));
+        } else {
+            s.push_back(alphabet[rng() % alphabet.size()]);
+        }
+    }
+    return s;
+}
+
+// Every byte value except `missing`, shuffled: a pattern set using exactly 255 bytes has a byte-class
+// map that is not the identity although it has 256 columns (255 classes plus the dead one)
+std::string all_bytes_but(std::mt19937_64& rng, unsigned char missing) {
+    std::string s;
+    for (int c = 0; c < 256; ++c) {
+        if (c != missing) {
+            s.push_back(static_cast<char>(c));
+        }
+    }
+    std::shuffle(s.begin(), s.end(), rng);
+    return s;
+}
+
+std::string hex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (char c : bytes) {
+        out += digits[static_cast<unsigned char>(c) >> 4];
+        out += digits[static_cast<unsigned char>(c) & 15];
+    }
+    return out;
+}
+
+// Random wildcard signature (see signature.h) and one byte string it matches: exact runs, ??,
+// bounded and (at most one) open gaps, and alternations, with random spacing
+std::pair<std::string, std::string> random_wildcard(std::mt19937_64& rng, const std::string& alphabet, bool binary) {
+    std::string signature, instance;
+    bool exact = false, open_gap = false;
+    for (size_t e = 1 + rng() % 5; e > 0 || !exact; e = e > 0 ? e - 1 : 0) {
+        switch (e == 0 ? 0 : rng() % 4) {
+            case 0: {
+                std::string bytes = random_text(rng, alphabet, 1 + rng() % 4, binary, 0);
+                signature += hex(bytes);
+                instance += bytes;
+                exact = true;
+                break;
+            }
+            case 1:
+                signature += "??";
+                instance += random_text(rng, alphabet, 1, binary, 5);
+                break;
+            case 2: {
+                ull lo = rng() % 3, hi = lo + rng() % 4;
+                bool open = !open_gap && rng() % 5 == 0;
+                open_gap = open_gap || open;
+                signature += "{" + std::to_string(lo) + (open ? "-" : lo == hi && rng() % 2 ? "" : "-" + std::to_string(hi)) + "}";
+                instance += random_text(rng, alphabet, lo + rng() % (hi - lo + 1 + (open ? 20 : 0)), binary, 5);
+                break;
+            }
+            default: {
+                std::vector<std::string> alternatives(2 + rng() % 2);
+                std::string text = "(";
+                for (auto& alternative : alternatives) {
+                    alternative = random_text(rng, alphabet, 1 + rng() % 3, binary, 0);
+                    text += (text.size() > 1 ? " | " : "") + hex(alternative);
+                }
+                signature += text + ")";
+                instance += alternatives[rng() % alternatives.size()];
+                exact = true;
+                break;
+            }
+        }
+        signature += rng() % 3 == 0 ? " " : "";
+    }
+    return {signature, instance};
+}
+
+// Adversarial document case: patterns are cut from the stripped text around line breaks (so they
+// straddle newlines and chunk boundaries), plus random, empty, duplicated and nested patterns
+TestCase random_case(std::mt19937_64& rng) {
+    TestCase tc;
+    const std::string& alphabet = ALPHABETS[rng() % ALPHABETS.size()];
+    bool binary = rng() % 4 == 0;
+    int newline_percent = std::vector<int>{0, 2, 10, 40}[rng() % 4];
+    size_t length = 1 + rng() % (rng() % 4 == 0 ? 20000 : 600);
+    tc.document = random_text(rng, alphabet, length, binary, newline_percent);
+
+    std::string stripped;
+    for (char c : tc.document) {
+        if (c != '\n') {
+            stripped.push_back(c);
+        }
+    }
+    size_t pattern_count = 1 + rng() % 12;
+    for (size_t p = 0; p < pattern_count; ++p) {
+        std::string pattern;
+        switch (rng() % 6) {
+            case 0:
+                pattern = random_text(rng, alphabet, 1 + rng() % 6, binary, 0);
+                break;
+            case 1:
+                pattern = "";
+                break;
+            case 2:
+                if (!tc.patterns.empty()) {
+                    const std::string& other = tc.patterns[rng() % tc.patterns.size()];
+                    // duplicate, prefix or suffix of an earlier pattern
+                    size_t cut = other.empty() ? 0 : rng() % other.size();
+                    pattern = rng() % 3 == 0 ? other : (rng() % 2 ? other.substr(0, cut + 1) : other.substr(cut));
+                    break;
+                }
+                [[fallthrough]];
+            default:
+                if (!stripped.empty()) {
+                    size_t begin = rng() % stripped.size();
+                    pattern = stripped.substr(begin, 1 + rng() % 24);
+                }
+                break;
+        }
+        pattern.erase(std::remove(pattern.begin(), pattern.end(), '\n'), pattern.end());
+        tc.patterns.push_back(pattern);
+    }
+    bool wide_alphabet = rng() % 8 == 0;
+    if (wide_alphabet) {
+        tc.patterns.push_back(all_bytes_but(rng, '\n'));
+    }
+
+    // Antivirus side: signatures may contain newlines and arbitrary bytes, files are planted with
+    // them at random offsets (including the very start and end)
+    size_t virus_count = 1 + rng() % 6;
+    for (size_t v = 0; v < virus_count; ++v) {
+        // identical signatures under different names must all be reported
+        std::string signature = rng() % 6 == 0 && !tc.viruses.empty() ? tc.viruses[rng() % tc.viruses.size()].second
+                                : random_text(rng, alphabet, rng() % 5 == 0 ? 0 : 1 + rng() % 12, binary, newline_percent);
+        tc.viruses.push_back({"virus0" + std::to_string(v + 1) + ".bin", signature});
+    }
+    if (wide_alphabet) {
+        tc.viruses.push_back({"virus0" + std::to_string(virus_count + 1) + ".bin", all_bytes_but(rng, static_cast<unsigned char>(rng() % 256))});
+    }
+    size_t file_count = 1 + rng() % 8;
+    for (size_t f = 0; f < file_count; ++f) {
+        std::string content = random_text(rng, alphabet, rng() % 5 == 0 ? 0 : rng() % 3000, binary, newline_percent);
+        for (size_t k = rng() % 3; k > 0 && !tc.viruses.empty(); --k) {
+            const std::string& signature = tc.viruses[rng() % tc.viruses.size()].second;
+            content.insert(content.empty() ? 0 : rng() % (content.size() + 1), signature);
+        }
+        tc.files.push_back({"d" + std::to_string(f % 3) + "/f" + std::to_string(f), content});
+    }
+
+    // Wildcard signatures, planted in some of the files (matches may also arise by chance)
+    size_t wildcard_count = rng() % 4;
+    for (size_t w = 0; w < wildcard_count; ++w) {
+        auto [signature, instance] = random_wildcard(rng, alphabet, binary);
+        tc.wildcards.push_back({"wild0" + std::to_string(w + 1) + ".sig", signature});
+        for (auto& [path, content] : tc.files) {
+            if (rng() % 3 == 0) {
+                content.insert(content.empty() ? 0 : rng() % (content.size() + 1), instance);
+            }
+        }
+    }
+    return tc;
+}
+
+// Function to compare an engine's output on stdin with an expected file (gen_data's expected.txt)
+// in the canonical form of the oracle; prints the first difference and returns the exit status
+int compare_expected(const std::string& expected_file, Scenario scenario) {
+    std::ifstream file(expected_file, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << expected_file << std::endl;
+        return 2;
+    }
+    std::ostringstream expected_text, actual_text;
+    expected_text << file.rdbuf();
+    actual_text << std::cin.rdbuf();
+    std::vector<std::string> expected = normalize(scenario, expected_text.str());
+    std::vector<std::string> actual = normalize(scenario, actual_text.str());
+    if (actual == expected) {
+        std::cout << "output matches " << expected_file << " (" << expected.size() << " lines)" << std::endl;
+        return 0;
+    }
+    size_t i = 0;
+    while (i < actual.size() && i < expected.size() && actual[i] == expected[i]) {
+        i++;
+    }
+    std::cout << "line " << i + 1 << " expected \"" << (i < expected.size() ? expected[i] : "<eof>")
+              << "\" got \"" << (i < actual.size() ? actual[i] : "<eof>") << "\"" << std::endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (opts.has("help")) {
+        std::cout << "Usage: differential_check [--cases=200] [--seed=N] [--threads=1,2,3,5,8]\n"
+                     "                          [--engines=name,name] [--bin-dir=.] [--work-dir=DIR] [--keep-failures]\n"
+                     "       <engine> | differential_check --expected=FILE [--scenario=document|antivirus]" << std::endl;
+        return 0;
+    }
+    // Compare mode; the scenario defaults to antivirus for a file under software_antivirus/
+    if (opts.has("expected")) {
+        std::string expected_file = opts.get("expected", "");
+        bool antivirus = expected_file.find("software_antivirus") != std::string::npos;
+        return compare_expected(expected_file, opts.get("scenario", antivirus ? "antivirus" : "document") == "antivirus" ? ANTIVIRUS : DOCUMENT);
+    }
+    ull cases = opts.get_ull("cases", 200);
+    ull seed = opts.get_ull("seed", 1);
+    fs::path bin_dir = fs::absolute(opts.get("bin-dir", fs::path(argv[0]).parent_path().string().empty() ? "." : fs::path(argv[0]).parent_path().string()));
+
+    std::vector<int> thread_counts;
+    std::stringstream thread_list(opts.get("threads", "1,2,3,5,8"));
+    for (std::string t; std::getline(thread_list, t, ',');) {
+        thread_counts.push_back(std::max(1, std::atoi(t.c_str())));
+    }
+
+    std::vector<Engine> engines;
+    std::string selected = "," + opts.get("engines", "") + ",";
+    for (const auto& engine : all_engines()) {
+        if (selected == ",," || selected.find("," + engine.name + ",") != std::string::npos) {
+            // antivirus_embedded is built per case from gen_signatures and its source
+            fs::path needed = engine.scenario == EMBEDDED ? bin_dir / "gen_signatures" : bin_dir / engine.name;
+            if (!fs::exists(needed) || (engine.scenario == EMBEDDED && !fs::exists(bin_dir / "code/antivirus_embedded.cpp"))) {
+                std::cerr << "Missing engine binary or source for " << engine.name << " in " << bin_dir.string() << std::endl;
+                return 1;
+            }
+            engines.push_back(engine);
+        }
+    }
+
+    fs::path work_dir = opts.get("work-dir", "");
+    if (work_dir.empty()) {
+        char pattern[] = "/tmp/differential_check_XXXXXX";
+        if (mkdtemp(pattern) == nullptr) {
+            std::cerr << "Error creating temporary directory" << std::endl;
+            return 1;
+        }
+        work_dir = pattern;
+    }
+
+    std::mt19937_64 rng(seed);
+    ull failed_cases = 0;
+    for (ull c = 0; c < cases; ++c) {
+        TestCase tc = random_case(rng);
+        std::ostringstream report;
+        if (check_case(tc, bin_dir, work_dir, engines, thread_counts, report) == 0) {
+            continue;
+        }
+        failed_cases++;
+        std::cout << "Case " << c << " (seed " << seed << ") FAILED" << std::endl << report.str();
+        if (opts.has("keep-failures")) {
+            fs::path keep = work_dir.string() + "_case" + std::to_string(c);
+            fs::remove_all(keep);
+            fs::copy(work_dir / "data", keep / "data", fs::copy_options::recursive);
+            std::cout << "  input kept in " << keep.string() << std::endl;
+        }
+    }
+    fs::remove_all(work_dir);
+
+    std::cout << cases - failed_cases << "/" << cases << " cases passed on " << engines.size() << " engines" << std::endl;
+    return failed_cases == 0 ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <omp.h>
+#include "cli.h"
+#include "dfa.h"
+#include "myers.h"
+#include "perf_counters.h"
+#include "query.h"
+#include "text_buffer.h"
+#include "trie.h"
+
+typedef unsigned long long ull;
+
+// Approximate document retrieval: every position where a pattern of target.txt ends with at most
+// --errors=K edits (insertions, deletions, substitutions; default 1), on the newline-stripped text.
+// Output is one line per pattern as in the exact engines (--mode=all|count|first-k|exists), except
+// that a hit is the offset of the last byte of the matching substring: with edits its start is
+// not unique.
+//
+// Split into K + 1 pieces, a pattern with at most K edits leaves at least one piece intact, so the
+// pieces of all patterns go into one DFA that scans the text in cache-sized chunks like
+// document_trie_parallel; every piece hit gives a window of the text around the possible match,
+// and the merged windows of each pattern are verified with Myers' bit-vector algorithm within the
+// chunk. Patterns whose pieces would be shorter than --min-piece (default 2) bytes would make the
+// filter useless and are scanned with Myers over the whole text instead, several in lockstep.
+
+// One piece of a pattern that goes through the filter: a hit of the piece at p gives the window
+// text[p - before, p + after), which holds every match of the pattern that leaves this piece intact
+struct Piece {
+    uint32_t pattern;
+    uint32_t before; // piece offset in the pattern + K
+    uint32_t after;  // pattern length - piece offset + K
+};
+
+// Candidate region text[begin, end) of a pattern
+struct Window {
+    uint32_t pattern;
+    ull begin, end;
+};
+
+// Function to count the bytes of every chunk that are not newlines, as prefix sums: kept[c] bytes
+// of the newline-stripped text come before chunk c
+std::vector<ull> count_kept(std::string_view text, ull chunk_size, ull num_chunks, ull num_threads) {
+    PERF_SCOPE("newlines");
+    std::vector<ull> kept(num_chunks + 1, 0);
+    #pragma omp parallel for num_threads(num_threads)
+    for (ull c = 0; c < num_chunks; ++c) {
+        ull count = 0;
+        for (ull j = c * chunk_size; j < std::min<ull>(text.size(), (c + 1) * chunk_size); ++j) {
+            count += text[j] != '\n';
+        }
+        kept[c + 1] = count;
+    }
+    for (ull c = 0; c < num_chunks; ++c) {
+        kept[c + 1] += kept[c];
+    }
+    return kept;
+}
+
+// Function to copy text[begin, end) without its newlines into `out`
+void strip_range(std::string_view text, ull begin, ull end, std::string& out) {
+    PERF_SCOPE("newlines");
+    out.resize(end - begin);
+    char* next = &out[0];
+    for (ull j = begin; j < end; ++j) {
+        *next = text[j];
+        next += text[j] != '\n';
+    }
+    out.resize(next - out.data());
+}
+
+int main(int argc, char* argv[]) {
+#ifdef VERBOSE
+    double start_time = omp_get_wtime();
+#endif
+    Options opts(argc, argv);
+    Query query(opts);
+    std::string textfile = "./data/document_retrieval/document.txt";
+    std::string patternsfile = "./data/document_retrieval/target.txt";
+    ull errors = opts.get_ull("errors", 1);
+    ull min_piece = std::max<ull>(1, opts.get_ull("min-piece", 2));
+    ull num_threads = omp_get_max_threads();
+    HugePagePolicy huge_pages = parse_huge_page_policy(opts.get("hugepages", "auto"));
+
+    std::ifstream patterns_file(patternsfile);
+    if (!patterns_file.is_open()) {
+        std::cerr << "Error opening file: " << patternsfile << std::endl;
+        return 1;
+    }
+    std::vector<std::string> patterns;
+    for (std::string pattern; std::getline(patterns_file, pattern);) {
+        patterns.push_back(pattern);
+    }
+
+    // Identical patterns are searched once, under the index of the first one
+    std::vector<ull> canonical(patterns.size());
+    std::unordered_map<std::string, ull> first;
+    for (ull i = 0; i < patterns.size(); ++i) {
+        canonical[i] = first.emplace(patterns[i], i).first->second;
+    }
+
+    // Pieces of the filtered patterns into the Trie (piece index = Trie pattern index), the
+    // others are scanned directly; single-word direct patterns go in groups of four
+    std::vector<MyersPattern> myers(patterns.size());
+    std::vector<Piece> pieces;
+    std::vector<std::string> piece_strings;
+    std::vector<ull> direct, direct_long;
+    for (ull i = 0; i < patterns.size(); ++i) {
+        const std::string& pattern = patterns[i];
+        if (canonical[i] != i || pattern.empty()) {
+            continue;
+        }
+        myers[i] = MyersPattern(pattern);
+        ull piece_length = pattern.size() / (errors + 1);
+        if (piece_length < min_piece) {
+            (pattern.size() <= 64 ? direct : direct_long).push_back(i);
+            continue;
+        }
+        for (ull p = 0; p <= errors; ++p) {
+            ull offset = p * piece_length;
+            ull length = p == errors ? pattern.size() - offset : piece_length;
+            pieces.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(offset + errors),
+                              static_cast<uint32_t>(pattern.size() - offset + errors)});
+            piece_strings.push_back(pattern.substr(offset, length));
+        }
+    }
+    Trie trie(huge_pages);
+    trie.set_alphabet(piece_strings);
+    for (ull p = 0; p < piece_strings.size(); ++p) {
+        trie.insert(piece_strings[p], p);
+    }
+    Dfa dfa(trie, -1, huge_pages);
+
+    TextBuffer buffer;
+    if (!read_file_first_touch(textfile, buffer, num_threads, huge_pages)) {
+        return 1;
+    }
+    if (buffer.view().empty()) {
+        return 1;
+    }
+    std::string_view document = buffer.view();
+    ull document_size = document.size();
+
+    ScanOptions scan_options;
+    scan_options.lanes = supported_lanes(static_cast<int>(opts.get_ull("lanes", 4)));
+    ull chunk_size = std::max<ull>(1, opts.get_ull("chunk-size", 256 << 10));
+    ull num_chunks = (document_size + chunk_size - 1) / chunk_size;
+    std::vector<ull> kept = count_kept(document, chunk_size, num_chunks, num_threads);
+
+    // Chunks are cut in the document as read. Every chunk reports the matches that end inside it
+    // (in the newline-stripped text). Any such match keeps a piece intact that starts at most
+    // max_length + K bytes before the chunk, so the thread strips that lead and the chunk into a
+    // buffer of its own, and the filter, Myers and the direct patterns all run on that copy: the
+    // text is never copied whole, and positions are the copy's offsets plus where it starts in the
+    // stripped text. The windows of the chunk are sorted, merged where they overlap (so an end is
+    // verified once) and checked with Myers while the chunk is still in cache. Direct patterns are
+    // scanned over the same range, reporting only ends inside the chunk
+    ull lead = errors;
+    for (const auto& pattern : patterns) {
+        lead = std::max<ull>(lead, pattern.size() + errors);
+    }
+    std::vector<std::vector<Hits>> threadHits(num_threads, std::vector<Hits>(patterns.size()));
+    std::vector<ull> threadWindows(num_threads, 0);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        ull thread_id = omp_get_thread_num();
+        std::vector<Hits>& localHits = threadHits[thread_id];
+        std::vector<Window> windows, sorted;
+        std::vector<ull> bucket(patterns.size(), 0), touched; // per pattern: window count, then slot
+        std::string text;
+        #pragma omp for schedule(dynamic, 1)
+        for (ull chunk = 0; chunk < num_chunks; ++chunk) {
+            // Back from the chunk start until `lead` bytes that are not newlines come before it
+            ull chunk_start = chunk * chunk_size;
+            ull copy_start = chunk_start, lead_bytes = 0;
+            while (copy_start > 0 && lead_bytes < lead) {
+                lead_bytes += document[--copy_start] != '\n';
+            }
+            strip_range(document, copy_start, std::min(document_size, chunk_start + chunk_size), text);
+            ull base = kept[chunk] - lead_bytes; // offset of text[0] in the stripped text
+            ull from = 0, start = lead_bytes, end = text.size();
+            if (!pieces.empty()) {
+                PERF_SCOPE("filter");
+                windows.clear();
+                scan_lanes(scan_options, dfa, text, from, end, from, [&](ull index, ull pos, int) {
+                    trie.for_each_duplicate(index, [&](ull piece) {
+                        const Piece& hit = pieces[piece];
+                        windows.push_back({hit.pattern, pos > hit.before ? pos - hit.before : 0,
+                                           std::min(end, pos + hit.after)});
+                    });
+                });
+                threadWindows[thread_id] += windows.size();
+
+                // Counting sort by pattern; within a pattern the windows arrive almost in order
+                for (const Window& window : windows) {
+                    if (bucket[window.pattern]++ == 0) {
+                        touched.push_back(window.pattern);
+                    }
+                }
+                ull offset = 0;
+                for (ull pattern : touched) {
+                    ull count = bucket[pattern];
+                    bucket[pattern] = offset;
+                    offset += count;
+                }
+                sorted.resize(windows.size());
+                for (const Window& window : windows) {
+                    sorted[bucket[window.pattern]++] = window;
+                }
+                for (ull pattern : touched) {
+                    bucket[pattern] = 0;
+                }
+                for (size_t w = 0; w < sorted.size();) {
+                    ull pattern = sorted[w].pattern;
+                    size_t slice_end = w;
+                    while (slice_end < sorted.size() && sorted[slice_end].pattern == pattern) {
+                        slice_end++;
+                    }
+                    std::sort(sorted.begin() + w, sorted.begin() + slice_end, [](const Window& a, const Window& b) {
+                        return a.begin < b.begin;
+                    });
+                    while (w < slice_end) {
+                        ull begin = sorted[w].begin, last = sorted[w].end;
+                        for (++w; w < slice_end && sorted[w].begin <= last; ++w) {
+                            last = std::max(last, sorted[w].end);
+                        }
+                        myers_scan(myers[pattern], text.data(), begin, last, start, errors, [&](ull j) {
+                            localHits[pattern].add(base + j, query);
+                        });
+                    }
+                }
+                touched.clear();
+            }
+            PERF_SCOPE("direct");
+            for (size_t g = 0; g < direct.size(); g += 4) {
+                const MyersPattern* group[4];
+                int count = static_cast<int>(std::min<size_t>(4, direct.size() - g));
+                for (int l = 0; l < count; ++l) {
+                    group[l] = &myers[direct[g + l]];
+                }
+                myers_scan_lanes<4>(group, count, text.data(), from, end, start, errors, [&](int lane, ull j) {
+                    localHits[direct[g + lane]].add(base + j, query);
+                });
+            }
+            for (ull i : direct_long) {
+                myers_scan(myers[i], text.data(), from, end, start, errors, [&](ull j) {
+                    localHits[i].add(base + j, query);
+                });
+            }
+        }
+    }
+
+    // Each pattern's rows are combined in thread order, in parallel over patterns
+    std::vector<Hits> patternHits(patterns.size());
+    #pragma omp parallel for schedule(dynamic, 64) num_threads(num_threads)
+    for (size_t p = 0; p < patterns.size(); ++p) {
+        PERF_SCOPE("merge");
+        patternHits[p] = std::move(threadHits[0][p]);
+        for (ull t = 1; t < num_threads; ++t) {
+            patternHits[p].merge(threadHits[t][p], query);
+        }
+        if (query.mode == MODE_ALL) {
+            std::sort(patternHits[p].positions.begin(), patternHits[p].positions.end());
+        }
+    }
+
+    // Output the results (--mode=all|count|first-k|exists)
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        patternHits[canonical[i]].print(std::cout, query);
+    }
+
+    if (opts.has("filter-report")) {
+        ull candidates = 0;
+        for (ull count : threadWindows) {
+            candidates += count;
+        }
+        std::cerr << "approx: " << pieces.size() << " pieces, " << dfa.state_count() << " states, " << candidates
+                  << " candidate windows, " << direct.size() + direct_long.size() << " patterns scanned directly" << std::endl;
+    }
+#ifdef VERBOSE
+    double end_time = omp_get_wtime();
+    std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
+#endif
+    PERF_REPORT();
+    return 0;
+}
@@ -3,34 +3,48 @@
 #include <string>
 #include <vector>
 #include <omp.h>
+#include "perf_counters.h"
 
 typedef unsigned long long ull;
 
 // Function to perform brute-force string matching
 std::vector<ull> brute_force_search(const std::string& text, const std::string& pattern) {
+    PERF_SCOPE("scan");
     std::vector<ull> positions;
     ull n = text.size();
     ull m = pattern.size();
-    ull newline_count = 0;
+    if (m == 0 || m > n) {
+        return positions;
+    }
 
     for (ull i = 0; i <= n - m; ++i) {
-        if (text[i] == '\n') {
-            ++newline_count;
-        }
         ull j = 0;
         while (j < m && text[i + j] == pattern[j]) {
             ++j;
         }
         if (j == m) {
-            positions.push_back(i - newline_count);
+            positions.push_back(i);
         }
     }
 
     return positions;
 }
 
+// Function to drop the newlines: matches may span lines and positions are counted on the joined text
+std::string strip_newlines(const std::string& text) {
+    std::string stripped;
+    stripped.reserve(text.size());
+    for (char ch : text) {
+        if (ch != '\n') {
+            stripped.push_back(ch);
+        }
+    }
+    return stripped;
+}
+
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -62,6 +76,7 @@ int main() {
     if (text.empty()) {
         return 1;
     }
+    text = strip_newlines(text);
 
     std::ifstream patterns_file(patternsfile);
     if (!patterns_file.is_open()) {
@@ -92,5 +107,6 @@ int main() {
 #endif
     patterns_file.close();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
@@ -2,37 +2,54 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <map>
 #include <omp.h>
+#include "cli.h"
+#include "perf_counters.h"
+#include "query.h"
 
 typedef unsigned long long ull;
 
-// Function to perform brute-force string matching
-std::vector<ull> brute_force_search(const std::string& text, const std::string& pattern) {
-    std::vector<ull> positions;
+// Function to perform brute-force string matching; the scan stops once the query has enough hits
+Hits brute_force_search(const std::string& text, const std::string& pattern, const Query& query) {
+    PERF_SCOPE("scan");
+    Hits hits;
     ull n = text.size();
     ull m = pattern.size();
-    ull newline_count = 0;
+    if (m == 0 || m > n) {
+        return hits;
+    }
 
-    #pragma omp parallel for
     for (ull i = 0; i <= n - m; ++i) {
-        if (text[i] == '\n') {
-            ++newline_count;
-        }
         ull j = 0;
         while (j < m && text[i + j] == pattern[j]) {
             ++j;
         }
         if (j == m) {
-            positions.push_back(i - newline_count);
+            hits.add(i, query);
+            if (hits.count >= query.enough()) {
+                break;
+            }
         }
     }
 
-    return positions;
+    return hits;
+}
+
+// Function to drop the newlines: matches may span lines and positions are counted on the joined text
+std::string strip_newlines(const std::string& text) {
+    std::string stripped;
+    stripped.reserve(text.size());
+    for (char ch : text) {
+        if (ch != '\n') {
+            stripped.push_back(ch);
+        }
+    }
+    return stripped;
 }
 
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -51,10 +68,12 @@ std::string read_file(const std::string& filename) {
     return buffer;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 #ifdef VERBOSE
     double start_time = omp_get_wtime();
 #endif 
+    Options opts(argc, argv);
+    Query query(opts);
     std::string textfile = "./data/document_retrieval/document.txt";
     std::string patternsfile = "./data/document_retrieval/target.txt";
 
@@ -64,6 +83,7 @@ int main() {
     if (text.empty()) {
         return 1;
     }
+    text = strip_newlines(text);
 
     std::ifstream patterns_file(patternsfile);
     if (!patterns_file.is_open()) {
@@ -72,28 +92,21 @@ int main() {
     }
 
     std::vector<std::string> patterns;
-    std::map<std::string, std::vector<ull>> pattern_positions;
     std::string pattern;
     while (std::getline(patterns_file, pattern)) {
         patterns.push_back(pattern);
     }
 
-    // Parallelize the pattern matching
-    #pragma omp parallel for
+    // Parallelize the pattern matching, each pattern writes only its own result slot
+    std::vector<Hits> pattern_hits(patterns.size());
+    #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < patterns.size(); ++i) {
-        std::vector<ull> positions = brute_force_search(text, patterns[i]);
-
-        pattern_positions[patterns[i]] = positions;
+        pattern_hits[i] = brute_force_search(text, patterns[i], query);
     }
 
-    // Output the results in the order of patterns in target.txt
-    for (const auto& p : patterns) {
-        const auto& positions = pattern_positions[p];
-        std::cout << positions.size();
-        for (auto pos : positions) {
-            std::cout << " " << pos;
-        }
-        std::cout << std::endl;
+    // Output the results in the order of patterns in target.txt (--mode=all|count|first-k|exists)
+    for (auto& hits : pattern_hits) {
+        hits.print(std::cout, query);
     }
 #ifdef VERBOSE
     double end_time = omp_get_wtime();
@@ -101,5 +114,6 @@ int main() {
 #endif 
     patterns_file.close();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+#include <omp.h>
+#include "cli.h"
+#include "perf_counters.h"
+#include "query.h"
+#include "suffix_array.h"
+
+typedef unsigned long long ull;
+
+std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::string buffer(size, ' ');
+    if (!file.read(&buffer[0], size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return "";
+    }
+
+    return buffer;
+}
+
+// Function to build the index of `textfile` into `indexfile`, reporting build time and disk size
+bool build_index(const std::string& textfile, const std::string& indexfile, const struct stat& source) {
+    double start = omp_get_wtime();
+    std::string text = read_file(textfile);
+    text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
+    if (text.size() >= 0xffffffffULL) {
+        std::cerr << "Document too large for a 32-bit suffix array: " << text.size() << " bytes" << std::endl;
+        return false;
+    }
+
+    double sort_start = omp_get_wtime();
+    std::vector<uint32_t> sa;
+    {
+        PERF_SCOPE("build");
+        sa = build_suffix_array(text);
+    }
+    double sort_seconds = omp_get_wtime() - sort_start;
+
+    IndexHeader header;
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.text_size = text.size();
+    header.source_size = source.st_size;
+    header.source_mtime_ns = static_cast<ull>(source.st_mtim.tv_sec) * 1000000000ULL + source.st_mtim.tv_nsec;
+    ull bytes = save_index(indexfile, header, text, sa);
+    if (bytes == 0) {
+        return false;
+    }
+    std::cerr << "index: " << text.size() << " bytes indexed in " << omp_get_wtime() - start << " s (suffix sort "
+              << sort_seconds << " s, " << omp_get_max_threads() << " threads), " << bytes << " bytes on disk ("
+              << static_cast<double>(bytes) / std::max<ull>(1, text.size()) << " per text byte)" << std::endl;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef VERBOSE
+    double start_time = omp_get_wtime();
+#endif
+    Options opts(argc, argv);
+    Query query(opts);
+    if (opts.has("help")) {
+        std::cout << "Usage: document_index [--index=FILE] [--targets=FILE] [--rebuild] [--build-only]\n"
+                     "                      [--mode=all|count|first-k|exists] [--k=10] [--index-report]" << std::endl;
+        return 0;
+    }
+    std::string textfile = "./data/document_retrieval/document.txt";
+    std::string patternsfile = opts.get("targets", "./data/document_retrieval/target.txt");
+    std::string indexfile = opts.get("index", "./data/document_retrieval/document.idx");
+
+    // The index is built once per document (or with --rebuild) and reused by every later batch of
+    // patterns; it is stale as soon as document.txt has another size or modification time
+    struct stat source;
+    if (stat(textfile.c_str(), &source) != 0) {
+        std::cerr << "Error opening file: " << textfile << std::endl;
+        return 1;
+    }
+    MappedIndex index;
+    bool fresh = !opts.has("rebuild") && index.open(indexfile) &&
+                 index.header().source_size == static_cast<ull>(source.st_size) &&
+                 index.header().source_mtime_ns == static_cast<ull>(source.st_mtim.tv_sec) * 1000000000ULL + source.st_mtim.tv_nsec;
+    if (!fresh) {
+        index.close();
+        if (!build_index(textfile, indexfile, source) || !index.open(indexfile)) {
+            return 1;
+        }
+    }
+    if (opts.has("build-only")) {
+        return 0;
+    }
+
+    std::ifstream patterns_file(patternsfile);
+    if (!patterns_file.is_open()) {
+        std::cerr << "Error opening file: " << patternsfile << std::endl;
+        return 1;
+    }
+    std::vector<std::string> patterns;
+    std::string pattern;
+    while (std::getline(patterns_file, pattern)) {
+        patterns.push_back(pattern);
+    }
+
+    // Every pattern is an SA interval lookup; positions are reported in ascending order. Count and
+    // exists queries never touch the positions, first-k reads the interval through a bounded heap
+    double query_start = omp_get_wtime();
+    std::string_view text = index.text();
+    const uint32_t* sa = index.sa();
+    std::vector<Hits> pattern_hits(patterns.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        PERF_SCOPE("scan");
+        auto [first, last] = find_interval(text, sa, patterns[i]);
+        Hits& hits = pattern_hits[i];
+        if (query.mode == MODE_ALL || query.mode == MODE_FIRST_K) {
+            for (ull j = first; j < last; ++j) {
+                hits.add(sa[j], query);
+            }
+            if (query.mode == MODE_ALL) {
+                std::sort(hits.positions.begin(), hits.positions.end());
+            }
+        } else {
+            hits.count = last - first;
+        }
+    }
+    if (opts.has("index-report")) {
+        std::cerr << "queries: " << patterns.size() << " patterns in " << omp_get_wtime() - query_start << " s" << std::endl;
+    }
+
+    for (const auto& hits : pattern_hits) {
+        hits.print(std::cout, query);
+    }
+
+#ifdef VERBOSE
+    double end_time = omp_get_wtime();
+    std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
+#endif
+    PERF_REPORT();
+    return 0;
+}
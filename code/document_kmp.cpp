@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <omp.h>
+#include "perf_counters.h"
 
 typedef unsigned long long ull;
 
@@ -32,23 +33,24 @@ std::vector<int> build_next_array(const std::string& pattern) {
 
 // Function to perform KMP string matching
 std::vector<ull> kmp_search(const std::string& text, const std::string& pattern) {
+    PERF_SCOPE("scan");
     std::vector<ull> positions;
     ull n = text.size();
     ull m = pattern.size();
+    if (m == 0) {
+        return positions;
+    }
     std::vector<int> next = build_next_array(pattern);
     ull i = 0;
     ull j = 0;
-    ull newline_count = 0;
 
     while (i < n) {
-        if (text[i] == '\n') ++newline_count;
-        
         if (text[i] == pattern[j]) {
             ++i;
             ++j;
 
             if (j == m) {
-                positions.push_back(i - j - newline_count);
+                positions.push_back(i - j);
                 j = next[j - 1];
             }
         } else {
@@ -63,8 +65,21 @@ std::vector<ull> kmp_search(const std::string& text, const std::string& pattern)
     return positions;
 }
 
+// Function to drop the newlines: matches may span lines and positions are counted on the joined text
+std::string strip_newlines(const std::string& text) {
+    std::string stripped;
+    stripped.reserve(text.size());
+    for (char ch : text) {
+        if (ch != '\n') {
+            stripped.push_back(ch);
+        }
+    }
+    return stripped;
+}
+
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -96,6 +111,7 @@ int main() {
     if (text.empty()) {
         return 1;
     }
+    text = strip_newlines(text);
 
     std::ifstream patterns_file(patternsfile);
     if (!patterns_file.is_open()) {
@@ -125,5 +141,6 @@ int main() {
 #endif
     patterns_file.close();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
@@ -2,8 +2,10 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <map>
 #include <omp.h>
+#include "cli.h"
+#include "perf_counters.h"
+#include "query.h"
 
 typedef unsigned long long ull;
 
@@ -32,27 +34,30 @@ std::vector<int> compute_lps(const std::string& pattern) {
     return lps;
 }
 
-// Function to perform KMP string matching
-std::vector<ull> kmp_search(const std::string& text, const std::string& pattern) {
-    std::vector<ull> positions;
+// Function to perform KMP string matching; the scan stops once the query has enough hits
+Hits kmp_search(const std::string& text, const std::string& pattern, const Query& query) {
+    PERF_SCOPE("scan");
+    Hits hits;
     int n = text.size();
     int m = pattern.size();
+    if (m == 0) {
+        return hits;
+    }
     std::vector<int> lps = compute_lps(pattern);
     int i = 0;
     int j = 0;
-    ull newline_count = 0;
 
     while (i < n) {
-        if (text[i] == '\n') {
-            ++newline_count;
-        }
         if (pattern[j] == text[i]) {
             j++;
             i++;
         }
 
         if (j == m) {
-            positions.push_back(i - j - newline_count);
+            hits.add(i - j, query);
+            if (hits.count >= query.enough()) {
+                break;
+            }
             j = lps[j - 1];
         } else if (i < n && pattern[j] != text[i]) {
             if (j != 0) {
@@ -63,11 +68,24 @@ std::vector<ull> kmp_search(const std::string& text, const std::string& pattern)
         }
     }
 
-    return positions;
+    return hits;
+}
+
+// Function to drop the newlines: matches may span lines and positions are counted on the joined text
+std::string strip_newlines(const std::string& text) {
+    std::string stripped;
+    stripped.reserve(text.size());
+    for (char ch : text) {
+        if (ch != '\n') {
+            stripped.push_back(ch);
+        }
+    }
+    return stripped;
 }
 
 // Function to read a file into a string
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -86,10 +104,12 @@ std::string read_file(const std::string& filename) {
     return buffer;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 #ifdef VERBOSE
     double start_time = omp_get_wtime();
 #endif
+    Options opts(argc, argv);
+    Query query(opts);
     std::string textfile = "./data/document_retrieval/document.txt";
     std::string patternsfile = "./data/document_retrieval/target.txt";
 
@@ -99,6 +119,7 @@ int main() {
     if (text.empty()) {
         return 1;
     }
+    text = strip_newlines(text);
 
     std::ifstream patterns_file(patternsfile);
     if (!patterns_file.is_open()) {
@@ -107,28 +128,21 @@ int main() {
     }
 
     std::vector<std::string> patterns;
-    std::map<std::string, std::vector<ull>> pattern_positions;
     std::string pattern;
     while (std::getline(patterns_file, pattern)) {
         patterns.push_back(pattern);
     }
 
-    // Parallelize the pattern matching
-    #pragma omp parallel for
+    // Parallelize the pattern matching, each pattern writes only its own result slot
+    std::vector<Hits> pattern_hits(patterns.size());
+    #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < patterns.size(); ++i) {
-        std::vector<ull> positions = kmp_search(text, patterns[i]);
-        
-        pattern_positions[patterns[i]] = positions;
+        pattern_hits[i] = kmp_search(text, patterns[i], query);
     }
 
-    // Output the results in the order of patterns in target.txt
-    for (const auto& p : patterns) {
-        const auto& positions = pattern_positions[p];
-        std::cout << positions.size();
-        for (auto pos : positions) {
-            std::cout << " " << pos;
-        }
-        std::cout << std::endl;
+    // Output the results in the order of patterns in target.txt (--mode=all|count|first-k|exists)
+    for (auto& hits : pattern_hits) {
+        hits.print(std::cout, query);
     }
 #ifdef VERBOSE
     double end_time = omp_get_wtime();
@@ -136,5 +150,6 @@ int main() {
 #endif
     patterns_file.close();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
@@ -4,33 +4,14 @@
 #include <vector>
 #include <unordered_map>
 #include <omp.h>
+#include "perf_counters.h"
+#include "trie.h"
 
 typedef unsigned long long ull;
 
-struct TrieNode {
-    std::vector<TrieNode*> children;
-    bool isEndOfWord;
-    ull patternIndex;
-
-    TrieNode() : isEndOfWord(false), patternIndex(-1) {
-        children.resize(256, nullptr); // ASCII 字符集
-    }
-};
-
-void insert(TrieNode* root, const std::string& pattern, ull patternIndex) {
-    TrieNode* node = root;
-    for (char ch : pattern) {
-        if (node->children[static_cast<unsigned char>(ch)] == nullptr) {
-            node->children[static_cast<unsigned char>(ch)] = new TrieNode();
-        }
-        node = node->children[static_cast<unsigned char>(ch)];
-    }
-    node->isEndOfWord = true;
-    node->patternIndex = patternIndex;
-}
-
 // Function to search for all patterns in the text using the Trie
-std::unordered_map<std::string, std::vector<ull>> search(const std::string& text, TrieNode* root, const std::vector<std::string>& patterns) {
+std::unordered_map<std::string, std::vector<ull>> search(const std::string& text, const Trie& trie, const std::vector<std::string>& patterns) {
+    PERF_SCOPE("scan");
     std::unordered_map<std::string, std::vector<ull>> foundPositions;
     ull newline_count = 0; // Count of newlines encountered
     for (ull i = 0; i < text.size(); ++i) {
@@ -38,19 +19,18 @@ std::unordered_map<std::string, std::vector<ull>> search(const std::string& text
             newline_count++;
             continue;
         }
-        TrieNode* node = root;
+        uint32_t node = trie.root();
         ull adjusted_i = i - newline_count; // Adjusted index that ignores newlines
         for (ull j = i; j < text.size(); ++j) {
             if (text[j] == '\n') {
-                newline_count++;
-                continue; 
+                continue; // newlines inside a match are skipped, they are counted by the outer loop
             }
-            if (node->children[static_cast<unsigned char>(text[j])] == nullptr) {
+            node = trie.next(node, static_cast<unsigned char>(text[j]));
+            if (node == 0) {
                 break;
             }
-            node = node->children[static_cast<unsigned char>(text[j])];
-            if (node->isEndOfWord) {
-                foundPositions[patterns[node->patternIndex]].push_back(adjusted_i);
+            if (trie.pattern(node) != Trie::NO_PATTERN) {
+                foundPositions[patterns[trie.pattern(node)]].push_back(adjusted_i);
             }
         }
     }
@@ -58,6 +38,7 @@ std::unordered_map<std::string, std::vector<ull>> search(const std::string& text
 }
 
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -97,7 +78,7 @@ int main() {
     }
 
     // Initialize the Trie tree
-    TrieNode* root = new TrieNode();
+    Trie trie;
 
     // Read patterns from the patterns file and insert them into the Trie tree
     std::vector<std::string> patterns;
@@ -105,11 +86,11 @@ int main() {
     std::string pattern;
     while (std::getline(patterns_file, pattern)) {
         patterns.push_back(pattern);
-        insert(root, pattern, patternIndex++);
+        trie.insert(pattern, patternIndex++);
     }
 
     // Perform the search using the Trie tree
-    std::unordered_map<std::string, std::vector<ull>> foundPositions = search(text, root, patterns);
+    std::unordered_map<std::string, std::vector<ull>> foundPositions = search(text, trie, patterns);
 
     // Output the results
     for (const auto& pattern : patterns) {
@@ -129,8 +110,9 @@ int main() {
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
-    delete root;
+    trie.clear();
     patterns_file.close();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
@@ -2,65 +2,80 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <unordered_map>
-#include <omp.h>
+#include <string_view>
+#include <cstring>
 #include <algorithm>
+#include <filesystem>
+#include <omp.h>
+#include "cli.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "query.h"
+#include "text_buffer.h"
+#include "dfa.h"
+#include "topology.h"
+#include "trie.h"
 
-typedef unsigned long long ull;
-
-struct TrieNode {
-    std::vector<TrieNode*> children;
-    bool isEndOfWord;
-    ull patternIndex; 
-
-    TrieNode() : isEndOfWord(false), patternIndex(-1) {
-        children.resize(256, nullptr); // ASCII 字符集
-    }
-};
+namespace fs = std::filesystem;
 
-void insert(TrieNode* root, const std::string& pattern, ull patternIndex) {
-    TrieNode* node = root;
-    for (char ch : pattern) {
-        if (node->children[static_cast<unsigned char>(ch)] == nullptr) {
-            node->children[static_cast<unsigned char>(ch)] = new TrieNode();
-        }
-        node = node->children[static_cast<unsigned char>(ch)];
-    }
-    node->isEndOfWord = true;
-    node->patternIndex = patternIndex;
-}
+typedef unsigned long long ull;
 
-// Function to search for all patterns in the text using the Trie
-void search(const std::string& text, TrieNode* root, const std::vector<std::string>& patterns, std::unordered_map<std::string, std::vector<ull>>& localFoundPositions, ull start, ull end) {
-    ull newline_count = 0; // Count of newlines encountered in the current chunk
+// Function to search for all patterns starting in [start, end) using the Trie and call
+// on_match(pattern, position, 0) for each, in ascending position order; matches may run past
+// `end`, and newline_base is the number of newlines before `start`. Without SkipNewlines the range
+// must not meet a newline (no pattern contains one, so a walk would stop there anyway)
+template <bool SkipNewlines, typename OnMatch>
+void search(std::string_view text, const Trie& trie, ull start, ull end, ull newline_base, OnMatch on_match) {
+    PERF_SCOPE("scan");
+    ull newline_count = newline_base; // Count of newlines before position i
     for (ull i = start; i < end; ++i) {
-        if (text[i] == '\n') {
+        if (SkipNewlines && text[i] == '\n') {
             newline_count++;
             continue;
         }
-        TrieNode* node = root;
+        uint32_t node = trie.root();
         for (ull j = i; j < text.size(); ++j) {
-            if (text[j] == '\n') {
-                newline_count++;
-                continue; 
+            if (SkipNewlines && text[j] == '\n') {
+                continue; // newlines inside a match are skipped, they are counted by the outer loop
             }
-            if (node->children[static_cast<unsigned char>(text[j])] == nullptr) {
+            node = trie.next(node, static_cast<unsigned char>(text[j]));
+            if (node == 0) {
                 break;
             }
-            node = node->children[static_cast<unsigned char>(text[j])];
-            if (node->isEndOfWord) {
-                localFoundPositions[patterns[node->patternIndex]].push_back(i - newline_count);
+            if (trie.pattern(node) != Trie::NO_PATTERN) {
+                on_match(trie.pattern(node), i - newline_count, 0);
             }
         }
     }
 }
 
-// Function to calculate the total number of newlines in each chunk
-void calculateNewlineTotals(const std::string& text, ull num_threads, ull chunk_size, std::vector<ull>& newlineTotals) {
+// Function to scan text[start, end) with the DFA kernels, or the Trie walk when dfa is null, and
+// report offsets on the newline-stripped text; `newlines` is the number of newlines in the range.
+// A range that meets no newline, up to the max_length - 1 bytes a match may run past `end`, gets
+// the kernels without newline skipping (unless options.generic)
+template <typename OnMatch>
+void scan_range(std::string_view text, const Trie& trie, const Dfa* dfa, ScanOptions options, ull max_length,
+                ull start, ull end, ull newline_base, ull newlines, OnMatch on_match) {
+    ull reach = std::min<ull>(text.size(), end + (max_length > 0 ? max_length - 1 : 0));
+    options.skip_newlines = options.generic || newlines > 0 ||
+                            std::memchr(text.data() + end, '\n', reach - end) != nullptr;
+    if (dfa != nullptr) {
+        scan_lanes(options, *dfa, text, start, end, start - newline_base, on_match);
+    } else if (options.skip_newlines) {
+        search<true>(text, trie, start, end, newline_base, on_match);
+    } else {
+        search<false>(text, trie, start, end, newline_base, on_match);
+    }
+}
+
+// Function to calculate the total number of newlines in each chunk (the last one may be shorter)
+void calculateNewlineTotals(std::string_view text, ull num_chunks, ull chunk_size, std::vector<ull>& newlineTotals) {
     #pragma omp parallel for
-    for (ull i = 0; i < num_threads; ++i) {
+    for (ull i = 0; i < num_chunks; ++i) {
         ull start = i * chunk_size;
-        ull end = (i == num_threads - 1) ? text.size() : start + chunk_size;
+        ull end = std::min<ull>(text.size(), start + chunk_size);
+        PERF_SCOPE("newlines");
         ull newline_count = 0;
         for (ull j = start; j < end; ++j) {
             if (text[j] == '\n') {
@@ -70,12 +85,13 @@ void calculateNewlineTotals(const std::string& text, ull num_threads, ull chunk_
         newlineTotals[i] = newline_count;
     }
 
-    for (ull i = 1; i < num_threads; ++i) {
+    for (ull i = 1; i < num_chunks; ++i) {
         newlineTotals[i] += newlineTotals[i - 1];
     }
 }
 
 std::string read_file(const std::string& filename) {
+    PERF_SCOPE("read");
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
@@ -94,108 +110,554 @@ std::string read_file(const std::string& filename) {
     return buffer;
 }
 
-int main() {
+// Function to list the documents of a corpus: every regular file under a directory (sorted by
+// path), or the paths in a file list, one per line
+std::vector<std::string> get_corpus_documents(const std::string& corpus) {
+    std::vector<std::string> documents;
+    if (fs::is_directory(corpus)) {
+        for (const auto& entry : fs::recursive_directory_iterator(corpus)) {
+            if (entry.is_regular_file()) {
+                documents.push_back(entry.path().string());
+            }
+        }
+        std::sort(documents.begin(), documents.end());
+        return documents;
+    }
+    std::ifstream list(corpus);
+    if (!list.is_open()) {
+        std::cerr << "Error opening file: " << corpus << std::endl;
+        return documents;
+    }
+    std::string path;
+    while (std::getline(list, path)) {
+        if (!path.empty()) {
+            documents.push_back(path);
+        }
+    }
+    return documents;
+}
+
+// Part of one corpus document scanned as a unit
+struct CorpusPiece {
+    ull document;
+    ull start, end;
+    ull newline_base; // newlines in the document before `start`
+};
+
+// Function to scan a whole corpus (--corpus=DIR|FILELIST) against one automaton and print the
+// results per document: a "# <path>" line, then one line per pattern as in single-document mode.
+// Documents are cut into pieces of at most chunk_size bytes, and consecutive small pieces are
+// packed into one task of about chunk_size bytes, so big files are split across threads and small
+// ones are scanned side by side, with the same task granularity as one big file
+int scan_corpus(const std::string& corpus, const Trie& trie, const Dfa* dfa, const ScanOptions& options, ull max_length,
+                ull chunk_size, ull num_threads, const Query& query, const std::vector<ull>& canonical, Metrics& metrics,
+                MemoryBudget& budget) {
+    std::vector<std::string> paths = get_corpus_documents(corpus);
+    if (paths.empty()) {
+        std::cerr << "Empty corpus: " << corpus << std::endl;
+        return 1;
+    }
+    ull corpus_bytes = 0;
+    for (const auto& path : paths) {
+        std::error_code size_error;
+        ull size = fs::file_size(path, size_error);
+        corpus_bytes += size_error ? 0 : size;
+    }
+    if (!budget.charge(MEMORY_INPUT, corpus_bytes)) {
+        std::cerr << "Memory budget of " << budget.limit() << " bytes is too small for the automata and the "
+                  << corpus_bytes << " bytes of the corpus" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> documents(paths.size());
+    bool read_ok = true;
+    metrics.set_phase("read");
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for (size_t d = 0; d < paths.size(); ++d) {
+        MetricTimer timer(metrics, omp_get_thread_num(), IO_NS);
+        documents[d] = read_file(paths[d]);
+        if (documents[d].empty() && !(fs::exists(paths[d]) && fs::file_size(paths[d]) == 0)) {
+            #pragma omp atomic write
+            read_ok = false;
+        }
+    }
+    if (!read_ok) {
+        return 1;
+    }
+
+    // With chunk_size 0 every document is one piece and one task
+    std::vector<CorpusPiece> pieces;
+    std::vector<ull> tasks; // first piece of every task, plus pieces.size()
+    ull task_bytes = chunk_size;
+    for (ull d = 0; d < documents.size(); ++d) {
+        ull size = documents[d].size();
+        for (ull start = 0; start < size;) {
+            ull end = chunk_size > 0 ? start + std::min(chunk_size, size - start) : size;
+            if (chunk_size == 0 || task_bytes >= chunk_size) {
+                tasks.push_back(pieces.size());
+                task_bytes = 0;
+            }
+            pieces.push_back({d, start, end, 0});
+            task_bytes += end - start;
+            start = end;
+        }
+    }
+    tasks.push_back(pieces.size());
+
+    // Newlines before every piece, within its document
+    std::vector<ull> newlines(pieces.size());
+    #pragma omp parallel for num_threads(num_threads)
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        PERF_SCOPE("newlines");
+        const char* text = documents[pieces[i].document].data();
+        ull newline_count = 0;
+        for (ull j = pieces[i].start; j < pieces[i].end; ++j) {
+            if (text[j] == '\n') {
+                newline_count++;
+            }
+        }
+        newlines[i] = newline_count;
+    }
+    for (size_t i = 1; i < pieces.size(); ++i) {
+        if (pieces[i].document == pieces[i - 1].document) {
+            pieces[i].newline_base = pieces[i - 1].newline_base + newlines[i - 1];
+        }
+    }
+
+    // Every piece keeps the Hits of the patterns it matched, collected in a per-thread row indexed
+    // by pattern id (reset through the list of touched ids)
+    size_t pattern_count = canonical.size();
+    std::vector<std::vector<std::pair<ull, Hits>>> pieceHits(pieces.size());
+    metrics.set_tasks(tasks.size() - 1);
+    metrics.set_phase("scan");
+    #pragma omp parallel num_threads(num_threads)
+    {
+        ull thread_id = omp_get_thread_num();
+        std::vector<Hits> local(pattern_count);
+        std::vector<ull> touched;
+        auto on_match = [&](ull index, ull pos, int) {
+            if (local[index].count == 0) {
+                touched.push_back(index);
+            }
+            local[index].add(pos, query);
+        };
+        auto on_count = [&](ull index, ull, int) {
+            if (local[index].count++ == 0) {
+                touched.push_back(index);
+            }
+        };
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t task = 0; task < tasks.size() - 1; ++task) {
+            metrics.add(thread_id, TASKS_TAKEN, 1);
+            for (ull i = tasks[task]; i < tasks[task + 1]; ++i) {
+                const CorpusPiece& piece = pieces[i];
+                std::string_view text = documents[piece.document];
+                auto scan_start = metrics.now();
+                if (query.mode == MODE_COUNT || query.mode == MODE_EXISTS) {
+                    scan_range(text, trie, dfa, options, max_length, piece.start, piece.end, piece.newline_base, newlines[i], on_count);
+                } else {
+                    scan_range(text, trie, dfa, options, max_length, piece.start, piece.end, piece.newline_base, newlines[i], on_match);
+                }
+                metrics.add(thread_id, MATCH_NS, metrics.elapsed_ns(scan_start));
+                metrics.add(thread_id, BYTES, piece.end - piece.start);
+                metrics.add(thread_id, FILES, piece.end == text.size() ? 1 : 0);
+                for (ull index : touched) {
+                    metrics.add(thread_id, HITS, local[index].count);
+                    pieceHits[i].emplace_back(index, std::move(local[index]));
+                    local[index] = Hits();
+                }
+                touched.clear();
+            }
+        }
+    }
+
+    // Output the results document by document
+    metrics.set_phase("output");
+    std::vector<Hits> documentHits(pattern_count);
+    size_t piece = 0;
+    for (ull d = 0; d < documents.size(); ++d) {
+        std::vector<ull> touched;
+        for (; piece < pieces.size() && pieces[piece].document == d; ++piece) {
+            for (auto& [index, hits] : pieceHits[piece]) {
+                touched.push_back(index);
+                documentHits[index].merge(hits, query);
+            }
+        }
+        // The lanes of a piece report alternately
+        if (query.mode == MODE_ALL) {
+            for (ull index : touched) {
+                std::sort(documentHits[index].positions.begin(), documentHits[index].positions.end());
+            }
+        }
+        std::cout << "# " << paths[d] << "\n";
+        for (size_t i = 0; i < pattern_count; ++i) {
+            documentHits[canonical[i]].print(std::cout, query);
+        }
+        for (ull index : touched) {
+            documentHits[index] = Hits();
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
 #ifdef VERBOSE
     double start_time = omp_get_wtime();
 #endif
+    Options opts(argc, argv);
+    Query query(opts);
     std::string textfile = "./data/document_retrieval/document.txt";
     std::string patternsfile = "./data/document_retrieval/target.txt";
 
-    // Read the entire text file into a string
-    std::string text = read_file(textfile);
-
-    if (text.empty()) {
-        return 1;
-    }
+    // Pin the team first (--pin=none|compact|scatter|cores|<cpu list>). The text is read with
+    // thread t first-touching the t-th of num_threads equal slices, so its pages land on that
+    // thread's NUMA node; the scan only keeps to that placement with a static split (see below)
+    ull num_threads = omp_get_max_threads();
+    std::vector<CpuInfo> topology = read_topology();
+    pin_threads(pin_order(topology, opts.get("pin", "none")), num_threads);
 
+    // Text buffer and Trie node pool are backed by huge pages (--hugepages=off|thp|2m|1g|auto)
+    HugePagePolicy huge_pages = parse_huge_page_policy(opts.get("hugepages", "auto"));
     std::ifstream patterns_file(patternsfile);
+
+    // Progress of the scan (--metrics=stderr|<prometheus file>, every --metrics-interval seconds)
+    Metrics metrics(opts.get("metrics", ""), opts.get_double("metrics-interval", 1), "document_trie_parallel", num_threads);
+    metrics.set_phase("build");
     if (!patterns_file.is_open()) {
         std::cerr << "Error opening file: " << patternsfile << std::endl;
         return 1;
     }
 
     // Initialize the Trie tree
-    TrieNode* root = new TrieNode();
+    Trie trie(huge_pages);
 
-    // Read patterns from the patterns file and insert them into the Trie tree
+    // Read patterns from the patterns file and insert them into the Trie tree (on all threads, see
+    // Trie::insert_all); unless --alphabet=full, rows only have columns for the bytes that occur in
+    // some pattern
     std::vector<std::string> patterns;
-    ull patternIndex = 0;
     std::string pattern;
     while (std::getline(patterns_file, pattern)) {
         patterns.push_back(pattern);
-        insert(root, pattern, patternIndex++);
     }
+    if (opts.get("alphabet", "classes") != "full") {
+        trie.set_alphabet(patterns);
+    }
+    trie.insert_all(patterns, num_threads);
 
-    // Perform the search using the Trie tree with OpenMP parallelization
-    std::unordered_map<std::string, std::vector<ull>> foundPositions;
-    ull text_size = text.size();
-    ull num_threads = omp_get_max_threads();
-    ull chunk_size = text_size / num_threads;
+    // By default (--engine=dfa) the Trie is compiled into a dense Aho-Corasick DFA in which '\n'
+    // is a transparent byte, and every thread steps --lanes=1|2|4|8 interleaved lanes of its chunk;
+    // --engine=trie keeps the per-position Trie walk. The scan kernel is specialized per range
+    // (table layout, newline skipping); --kernel=generic always runs the 32-bit class-lookup
+    // kernel with newline skipping, for comparison
+    bool use_dfa = opts.get("engine", "dfa") != "trie";
+    ScanOptions scan_options;
+    scan_options.lanes = use_dfa ? supported_lanes(static_cast<int>(opts.get_ull("lanes", 4))) : 1;
+    scan_options.generic = opts.get("kernel", "auto") == "generic";
+    int lanes = scan_options.lanes;
+    Dfa dfa;
+    if (use_dfa) {
+        dfa = Dfa(trie, '\n', huge_pages, !scan_options.generic);
+    }
+    ull max_length = 0;
+    for (const auto& p : patterns) {
+        max_length = std::max<ull>(max_length, p.size());
+    }
+
+    // Hits are stored by pattern id. Identical patterns share the Trie node of the first one
+    // inserted (its canonical id), so every pattern reads its results from that id
+    std::vector<ull> canonical(patterns.size());
+    for (ull i = 0; i < patterns.size(); ++i) {
+        canonical[i] = trie.canonical(i);
+    }
+
+    // Memory accounting (--memory-report) and --memory-budget=SIZE. The text is held whole, so the
+    // run is refused up front when the patterns, automata and text do not fit, rather than being
+    // killed part way through; results are only accounted
+    MemoryBudget budget(opts.get_ull("memory-budget", 0));
+    ull pattern_bytes = 0;
+    for (const auto& p : patterns) {
+        pattern_bytes += p.capacity();
+    }
+    budget.charge(MEMORY_PATTERNS, pattern_bytes);
+    budget.charge(MEMORY_AUTOMATON, trie.memory_bytes() + dfa.memory_bytes());
+    auto memory_report = [&]() {
+        if (opts.has("memory-report")) {
+            std::cerr << "trie: " << trie.node_count() << " nodes, " << trie.memory_bytes() << " bytes; dfa: "
+                      << dfa.state_count() << " states, " << dfa.memory_bytes() << " bytes" << std::endl;
+            budget.report(std::cerr);
+        }
+    };
 
-    size_t max_pattern_length = 0;
-    for (const auto& pattern : patterns) {
-        max_pattern_length = std::max(max_pattern_length, pattern.size());
+    // Corpus mode: many documents against the one automaton, results per document
+    if (opts.has("corpus")) {
+        int status = scan_corpus(opts.get("corpus", ""), trie, use_dfa ? &dfa : nullptr, scan_options, max_length,
+                                 opts.get_ull("chunk-size", 256 << 10), num_threads, query, canonical, metrics, budget);
+        metrics.set_phase("done");
+        metrics.stop();
+        memory_report();
+        PERF_REPORT();
+        return status;
     }
 
-    #pragma omp parallel
+    std::error_code size_error;
+    ull text_bytes = fs::file_size(textfile, size_error);
+    if (!budget.charge(MEMORY_INPUT, size_error ? 0 : text_bytes)) {
+        std::cerr << "Memory budget of " << budget.limit() << " bytes is too small for the automata and the "
+                  << text_bytes << " bytes of " << textfile << std::endl;
+        return 1;
+    }
+    TextBuffer buffer;
+    metrics.set_phase("read");
+    if (!read_file_first_touch(textfile, buffer, num_threads, huge_pages, &metrics)) {
+        return 1;
+    }
+    std::string_view text = buffer.view();
+
+    if (text.empty()) {
+        return 1;
+    }
+
+    // Perform the search using the Trie tree with OpenMP parallelization. The text is cut into
+    // --chunk-size tasks (default 256K, so a task and the hot part of the automaton stay in L2) that
+    // the threads take dynamically, which evens out dense-hit regions and slow cores;
+    // --chunk-size=0 gives every thread one equal slice. Taking tasks dynamically ignores where the
+    // pages were first-touched, so with --pin or --replicate-trie every thread scans a contiguous
+    // block of tasks instead (schedule(static), the slice it read itself up to one task): memory
+    // stays node-local, at the price of the load balancing
+    bool two_pass = opts.has("two-pass") && query.mode == MODE_ALL;
+    ull text_size = text.size();
+    ull chunk_size = opts.get_ull("chunk-size", 256 << 10);
+    bool numa_static = opts.get("pin", "none") != "none" || opts.has("replicate-trie");
+    ull num_chunks = chunk_size > 0 ? (text_size + chunk_size - 1) / chunk_size : num_threads;
+    if (two_pass) {
+        // The two-pass offset table has a row per (chunk, lane) slot; keep it no larger than the text
+        ull row_bytes = static_cast<ull>(lanes) * std::max<size_t>(1, patterns.size()) * sizeof(ull);
+        num_chunks = std::min(num_chunks, std::max<ull>(num_threads, text_size / row_bytes));
+    }
+    num_chunks = std::max<ull>(1, std::min(num_chunks, text_size));
+    chunk_size = (text_size + num_chunks - 1) / num_chunks;
+    num_chunks = (text_size + chunk_size - 1) / chunk_size;
+
+    // Calculate the total number of newlines in each chunk first, so every task can report
+    // positions on the newline-stripped text directly
+    metrics.set_phase("newlines");
+    std::vector<ull> newlineTotals(num_chunks);
+    calculateNewlineTotals(text, num_chunks, chunk_size, newlineTotals);
+
+    // With --replicate-trie every NUMA node scans its own copy of the (read-only) Trie or DFA
+    int nodes = node_count(topology);
+    bool replicate = opts.has("replicate-trie") && nodes > 1;
+    std::vector<Trie> nodeTries(replicate && !use_dfa ? nodes : 0);
+    std::vector<Dfa> nodeDfas(replicate && use_dfa ? nodes : 0);
+    std::vector<bool> nodeReplicated(nodes, false);
+    std::vector<int> threadNode(num_threads, 0);
+    std::vector<double> scanSeconds(num_threads, 0);
+    std::vector<ull> scanBytes(num_threads, 0);
+
+    // Results, by pattern id. One pass: every thread fills its own row of Hits, which are combined
+    // per pattern afterwards. --two-pass (with --mode=all): the first scan only counts the hits of
+    // every (chunk, lane) slot, a prefix sum turns the counts into offsets in one contiguous buffer
+    // in which each pattern's slots are laid out in position order, and the second scan writes the
+    // positions straight into place, so they come out sorted with no merge step at all
+    ull slots = num_chunks * lanes;
+    std::vector<std::vector<Hits>> threadHits(two_pass ? 0 : num_threads, std::vector<Hits>(patterns.size()));
+    std::vector<std::vector<ull>> slotCursor(two_pass ? slots : 0, std::vector<ull>(patterns.size(), 0));
+    std::vector<ull> patternStart(patterns.size() + 1, 0);
+    std::vector<ull> positions;
+    metrics.set_tasks(num_chunks);
+    metrics.set_phase("scan");
+
+    // Each task owns exactly the matches that start inside its chunk. Both scans read on past the
+    // chunk end until every such match is complete, counting only non-newline bytes (the trie walk
+    // to the first dead end, the DFA lanes max_depth - 1 countable bytes), so a match is found
+    // whatever the number of newlines or chunk boundaries it spans, and never twice
+    #pragma omp parallel num_threads(num_threads)
     {
-        std::unordered_map<std::string, std::vector<ull>> localFoundPositions;
         ull thread_id = omp_get_thread_num();
-        ull start = thread_id * chunk_size;
-        ull end = (thread_id == num_threads - 1) ? text_size : start + chunk_size + max_pattern_length;
-        search(text, root, patterns, localFoundPositions, start, end);
+        int node = node_of_cpu(topology, sched_getcpu());
+        threadNode[thread_id] = node;
 
-        #pragma omp critical
-        {
-            for (const auto& entry : localFoundPositions) {
-                foundPositions[entry.first].insert(foundPositions[entry.first].end(), entry.second.begin(), entry.second.end());
+        const Trie* localTrie = &trie;
+        const Dfa* localDfa = &dfa;
+        if (replicate) {
+            // The first thread of each node makes the copy, so first touch places it on that node
+            #pragma omp critical
+            {
+                if (!nodeReplicated[node]) {
+                    if (use_dfa) {
+                        nodeDfas[node] = dfa.clone();
+                    } else {
+                        nodeTries[node] = trie.clone();
+                    }
+                    nodeReplicated[node] = true;
+                }
             }
+            localTrie = use_dfa ? &trie : &nodeTries[node];
+            localDfa = use_dfa ? &nodeDfas[node] : &dfa;
         }
-    }
 
+        // Runs on_match over every chunk this thread takes; the first pass records which chunks those
+        // were, and the second pass of --two-pass replays them (the slots are per chunk anyway)
+        std::vector<ull> taken;
+        auto scan_chunk = [&](ull chunk, auto on_match) {
+            ull start = chunk * chunk_size;
+            ull end = std::min(text_size, start + chunk_size);
+            ull newline_base = chunk > 0 ? newlineTotals[chunk - 1] : 0;
+            scan_range(text, *localTrie, use_dfa ? localDfa : nullptr, scan_options, max_length, start, end,
+                       newline_base, newlineTotals[chunk] - newline_base, on_match);
+        };
+        auto scan = [&](auto on_match) {
+            auto task = [&](ull chunk) {
+                taken.push_back(chunk);
+                ull bytes = std::min(text_size, (chunk + 1) * chunk_size) - chunk * chunk_size;
+                scanBytes[thread_id] += bytes;
+                metrics.add(thread_id, TASKS_TAKEN, 1);
+                auto chunk_start = metrics.now();
+                ull hits = 0;
+                scan_chunk(chunk, [&](ull index, ull pos, int lane) {
+                    hits++;
+                    on_match(chunk, index, pos, lane);
+                });
+                metrics.add(thread_id, MATCH_NS, metrics.elapsed_ns(chunk_start));
+                metrics.add(thread_id, BYTES, bytes);
+                metrics.add(thread_id, HITS, hits);
+            };
+            if (numa_static) {
+                #pragma omp for schedule(static) nowait
+                for (ull chunk = 0; chunk < num_chunks; ++chunk) {
+                    task(chunk);
+                }
+            } else {
+                #pragma omp for schedule(dynamic, 1) nowait
+                for (ull chunk = 0; chunk < num_chunks; ++chunk) {
+                    task(chunk);
+                }
+            }
+        };
 
-    // Calculate the total number of newlines in each chunk
-    std::vector<ull> newlineTotals(num_threads);
-    calculateNewlineTotals(text, num_threads, chunk_size, newlineTotals);
+        double scan_start = omp_get_wtime();
+        if (!two_pass) {
+            std::vector<Hits>& localHits = threadHits[thread_id];
+            if (query.mode == MODE_COUNT || query.mode == MODE_EXISTS) {
+                scan([&](ull, ull index, ull, int) {
+                    localHits[index].count++;
+                });
+            } else {
+                scan([&](ull, ull index, ull pos, int) {
+                    localHits[index].add(pos, query);
+                });
+            }
+        } else {
+            scan([&](ull chunk, ull index, ull, int lane) {
+                slotCursor[chunk * lanes + lane][index]++;
+            });
+            #pragma omp barrier
+            #pragma omp single
+            {
+                PERF_SCOPE("merge");
+                ull offset = 0;
+                for (size_t p = 0; p < patterns.size(); ++p) {
+                    patternStart[p] = offset;
+                    for (ull slot = 0; slot < slots; ++slot) {
+                        ull count = slotCursor[slot][p];
+                        slotCursor[slot][p] = offset;
+                        offset += count;
+                    }
+                }
+                patternStart[patterns.size()] = offset;
+                positions.resize(offset);
+            }
+            for (ull chunk : taken) {
+                ull* cursor[8];
+                for (int l = 0; l < lanes; ++l) {
+                    cursor[l] = slotCursor[chunk * lanes + l].data();
+                }
+                scan_chunk(chunk, [&](ull index, ull pos, int lane) {
+                    positions[cursor[lane][index]++] = pos;
+                });
+            }
+        }
+        scanSeconds[thread_id] = omp_get_wtime() - scan_start;
+    }
 
-    // // Output the newline totals
-    // for (ull i = 0; i < num_threads; ++i) {
-    //     std::cout << "Chunk " << i << " newline total: " << newlineTotals[i] << std::endl;
-    // }
+    ull result_bytes = positions.capacity() * sizeof(ull) + slotCursor.size() * patterns.size() * sizeof(ull);
+    for (const auto& row : threadHits) {
+        for (const Hits& hits : row) {
+            result_bytes += sizeof(Hits) + hits.positions.capacity() * sizeof(ull);
+        }
+    }
+    budget.track(MEMORY_RESULTS, result_bytes);
 
-    // std::cout << "======================================================" << std::endl;    
+    // One-pass results: each pattern's rows are combined in thread order, in parallel over patterns,
+    // and sorted, since the lanes of a chunk report alternately and the chunks a thread took are
+    // wherever the schedule put them
+    metrics.set_phase("merge");
+    std::vector<Hits> patternHits(two_pass ? 0 : patterns.size());
+    if (!two_pass) {
+        PERF_SCOPE("merge");
+        #pragma omp parallel for schedule(dynamic, 64) num_threads(num_threads)
+        for (size_t p = 0; p < patterns.size(); ++p) {
+            patternHits[p] = std::move(threadHits[0][p]);
+            for (ull t = 1; t < num_threads; ++t) {
+                patternHits[p].merge(threadHits[t][p], query);
+            }
+            if (query.mode == MODE_ALL) {
+                std::sort(patternHits[p].positions.begin(), patternHits[p].positions.end());
+            }
+        }
+    }
 
+    if (opts.has("hugepages-report")) {
+        std::cerr << "text buffer: " << describe_mapping(buffer.mapping()) << std::endl;
+        std::cerr << "trie: " << trie.distinct_patterns() << " distinct patterns, " << trie.node_count() << " nodes, " << trie.byte_classes() << " byte classes, " << describe_mapping(trie.mapping()) << std::endl;
+        if (use_dfa) {
+            std::cerr << "dfa: " << dfa.state_count() << " states, " << dfa.byte_classes() << " byte classes, " << describe_mapping(dfa.mapping()) << std::endl;
+        }
+    }
 
-    // Update positions based on the total number of newlines in previous chunks
-    for (auto& entry : foundPositions) {
-        for (auto& pos : entry.second) {
-            ull chunk_id = pos / chunk_size;
-            if (chunk_id > 0) {
-                pos -= newlineTotals[chunk_id - 1]; // Subtract the total number of newlines in previous chunks
+    // Per-node scan bandwidth: bytes of the chunks the node's threads took over its slowest thread
+    if (opts.has("numa-report")) {
+        for (int node = 0; node < nodes; ++node) {
+            ull bytes = 0, threads = 0;
+            double seconds = 0;
+            for (ull t = 0; t < num_threads; ++t) {
+                if (threadNode[t] == node) {
+                    bytes += scanBytes[t];
+                    seconds = std::max(seconds, scanSeconds[t]);
+                    threads++;
+                }
+            }
+            if (threads > 0) {
+                std::cerr << "node " << node << ": " << threads << " threads, " << bytes << " bytes, " << seconds
+                          << " s, " << (seconds > 0 ? bytes / seconds / 1e9 : 0) << " GB/s" << std::endl;
             }
         }
     }
 
-    // Output the results
-    for (const auto& pattern : patterns) {
-        auto it = foundPositions.find(pattern);
-        if (it != foundPositions.end()) {
-            std::cout << it->second.size();
-            for (auto pos : it->second) {
-                std::cout << " " << pos;
-            }
-            std::cout << std::endl;
-        } else {
-            std::cout << "0" << std::endl;
+    // Output the results (--mode=all|count|first-k|exists)
+    metrics.set_phase("output");
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        ull id = canonical[i];
+        if (!two_pass) {
+            patternHits[id].print(std::cout, query);
+            continue;
+        }
+        std::cout << patternStart[id + 1] - patternStart[id];
+        for (ull j = patternStart[id]; j < patternStart[id + 1]; ++j) {
+            std::cout << " " << positions[j];
         }
+        std::cout << std::endl;
     }
+    metrics.set_phase("done");
+    metrics.stop();
+    memory_report();
 
 #ifdef VERBOSE
     double end_time = omp_get_wtime();
     std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
 #endif
-    delete root;
+    trie.clear();
     patterns_file.close();
 
+    PERF_REPORT();
     return 0;
 }
\ No newline at end of file
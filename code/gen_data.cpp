@@ -0,0 +1,327 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <filesystem>
+#include <algorithm>
+#include <omp.h>
+#include "cli.h"
+
+namespace fs = std::filesystem;
+
+// Deterministic generator: only the raw mt19937_64 stream is used (the std distributions are
+// implementation-defined), so the same seed yields byte-identical data on every platform
+struct Rng {
+    std::mt19937_64 engine;
+
+    explicit Rng(ull seed) : engine(seed) {}
+
+    // Uniform integer in [lo, hi]
+    ull uniform(ull lo, ull hi) {
+        if (hi <= lo) {
+            return lo;
+        }
+        return lo + engine() % (hi - lo + 1);
+    }
+
+    bool chance(double p) {
+        return (engine() >> 11) * (1.0 / 9007199254740992.0) < p;
+    }
+
+    // Roughly log-uniform size in [lo, hi]: pick a power-of-two bucket first, then a size inside it
+    ull log_uniform(ull lo, ull hi) {
+        if (hi <= lo) {
+            return lo;
+        }
+        int lo_bits = 0, hi_bits = 0;
+        while ((2ULL << lo_bits) <= lo) lo_bits++;
+        while ((2ULL << hi_bits) <= hi) hi_bits++;
+        int bits = static_cast<int>(uniform(lo_bits, hi_bits));
+        ull begin = std::max(lo, 1ULL << bits);
+        ull end = std::min(hi, (2ULL << bits) - 1);
+        return uniform(begin, std::max(begin, end));
+    }
+};
+
+std::string random_string(Rng& rng, const std::string& alphabet, ull length) {
+    std::string s(length, ' ');
+    for (ull i = 0; i < length; ++i) {
+        s[i] = alphabet[rng.uniform(0, alphabet.size() - 1)];
+    }
+    return s;
+}
+
+std::string random_bytes(Rng& rng, ull length) {
+    std::string s(length, ' ');
+    for (ull i = 0; i < length; ++i) {
+        s[i] = static_cast<char>(rng.uniform(0, 255));
+    }
+    return s;
+}
+
+bool write_file(const std::string& filename, const std::string& content) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open() || !file.write(content.data(), content.size())) {
+        std::cerr << "Error writing file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Only directories this tool created itself may be wiped and regenerated. The marker lives next to
+// the directory rather than inside it so the engines never see it as a text or signature file
+bool prepare_directory(const fs::path& dir, bool force) {
+    fs::path marker = dir.parent_path() / ("." + dir.filename().string() + ".generated");
+    if (fs::exists(dir)) {
+        if (!force && !fs::exists(marker)) {
+            std::cerr << "Refusing to overwrite " << dir.string() << " (not generated by gen_data, use --force)" << std::endl;
+            return false;
+        }
+        fs::remove_all(dir);
+    }
+    fs::create_directories(dir);
+    return write_file(marker.string(), "");
+}
+
+// Target list with controlled lengths and prefix sharing: a shared pattern reuses a random prefix
+// of an earlier pattern, which is what makes trie-based engines branch deep
+std::vector<std::string> generate_patterns(Rng& rng, const Options& opts, const std::string& alphabet) {
+    ull count = opts.get_ull("patterns", 100);
+    ull min_len = std::max(1ULL, opts.get_ull("min-pattern-length", 4));
+    ull max_len = std::max(min_len, opts.get_ull("max-pattern-length", 32));
+    double prefix_share = opts.get_double("prefix-share", 0.3);
+
+    std::vector<std::string> patterns;
+    for (ull i = 0; i < count; ++i) {
+        ull length = rng.uniform(min_len, max_len);
+        std::string pattern;
+        if (!patterns.empty() && rng.chance(prefix_share)) {
+            const std::string& base = patterns[rng.uniform(0, patterns.size() - 1)];
+            pattern = base.substr(0, rng.uniform(1, std::min<ull>(base.size(), length)));
+        }
+        pattern += random_string(rng, alphabet, length - pattern.size());
+        patterns.push_back(pattern);
+    }
+    return patterns;
+}
+
+// Positions are reported on the newline-stripped text, exactly like the document_* binaries
+std::vector<std::vector<ull>> expected_positions(const std::string& content, const std::vector<std::string>& patterns) {
+    std::vector<std::vector<ull>> positions(patterns.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if (patterns[i].empty()) {
+            continue;
+        }
+        for (size_t pos = content.find(patterns[i]); pos != std::string::npos; pos = content.find(patterns[i], pos + 1)) {
+            positions[i].push_back(pos);
+        }
+    }
+    return positions;
+}
+
+bool generate_document(Rng& rng, const Options& opts, const fs::path& out) {
+    fs::path dir = out / "document_retrieval";
+    if (!prepare_directory(dir, opts.has("force"))) {
+        return false;
+    }
+
+    double scale = opts.get_double("scale", 1.0);
+    ull doc_size = static_cast<ull>(opts.get_ull("doc-size", 300ULL << 20) * scale);
+    ull line_length = std::max(1ULL, opts.get_ull("line-length", 80));
+    double hit_density = opts.get_double("hit-density", 0.1);
+    std::string alphabet = opts.get("alphabet", "abcdefghijklmnopqrstuvwxyz");
+    alphabet.erase(std::remove(alphabet.begin(), alphabet.end(), '\n'), alphabet.end());
+    if (alphabet.empty()) {
+        std::cerr << "Empty alphabet" << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> patterns = generate_patterns(rng, opts, alphabet);
+
+    // Build the newline-free content first and plant the hits in it, so planted hits straddle
+    // line breaks naturally once the newlines are inserted
+    std::string content = random_string(rng, alphabet, doc_size);
+    ull planted = 0;
+    double size_mb = static_cast<double>(doc_size) / (1 << 20);
+    for (const auto& pattern : patterns) {
+        if (pattern.size() > content.size()) {
+            continue;
+        }
+        double want = hit_density * size_mb;
+        ull hits = static_cast<ull>(want) + (rng.chance(want - static_cast<ull>(want)) ? 1 : 0);
+        for (ull h = 0; h < hits; ++h) {
+            content.replace(rng.uniform(0, content.size() - pattern.size()), pattern.size(), pattern);
+            planted++;
+        }
+    }
+
+    std::string document;
+    document.reserve(content.size() + content.size() / line_length * 2 + 1);
+    ull min_line = std::max(1ULL, line_length / 2);
+    ull max_line = line_length + line_length / 2;
+    for (ull pos = 0; pos < content.size();) {
+        ull len = std::min<ull>(rng.uniform(min_line, max_line), content.size() - pos);
+        document.append(content, pos, len);
+        document.push_back('\n');
+        pos += len;
+    }
+
+    std::string targets;
+    for (const auto& pattern : patterns) {
+        targets += pattern + "\n";
+    }
+
+    std::vector<std::vector<ull>> positions = expected_positions(content, patterns);
+    std::string expected;
+    for (const auto& list : positions) {
+        expected += std::to_string(list.size());
+        for (ull pos : list) {
+            expected += " " + std::to_string(pos);
+        }
+        expected += "\n";
+    }
+
+    if (!write_file((dir / "document.txt").string(), document) ||
+        !write_file((dir / "target.txt").string(), targets) ||
+        !write_file((dir / "expected.txt").string(), expected)) {
+        return false;
+    }
+    std::cout << "document_retrieval: " << document.size() << " bytes, " << patterns.size()
+              << " patterns, " << planted << " planted hits" << std::endl;
+    return true;
+}
+
+bool generate_antivirus(Rng& rng, const Options& opts, const fs::path& out) {
+    std::string tree_name = opts.get("tree-name", "opencv-4.10.0");
+    fs::path tree = out / "software_antivirus" / tree_name;
+    fs::path virus_dir = out / "software_antivirus" / "virus";
+    if (!prepare_directory(tree, opts.has("force")) || !prepare_directory(virus_dir, opts.has("force"))) {
+        return false;
+    }
+
+    double scale = opts.get_double("scale", 1.0);
+    ull file_count = static_cast<ull>(opts.get_ull("files", 8000) * scale);
+    ull min_size = opts.get_ull("min-file-size", 64);
+    ull max_size = std::max(min_size, opts.get_ull("max-file-size", 128ULL << 10));
+    double binary_fraction = opts.get_double("binary-fraction", 0.1);
+    double infected_fraction = opts.get_double("infected-fraction", 0.002);
+    ull max_dir_depth = opts.get_ull("max-dir-depth", 3);
+    ull virus_count = opts.get_ull("viruses", 10);
+    ull min_virus = std::max(1ULL, opts.get_ull("min-virus-size", 64));
+    ull max_virus = std::max(min_virus, opts.get_ull("max-virus-size", 4096));
+    const std::string source_alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 \n\t{}();=+-*/<>,.#_\"";
+
+    std::vector<std::string> virus_names;
+    std::vector<std::string> viruses;
+    int width = std::max<int>(2, std::to_string(virus_count).size());
+    for (ull v = 1; v <= virus_count; ++v) {
+        std::string number = std::to_string(v);
+        virus_names.push_back("virus" + std::string(width - number.size(), '0') + number + ".bin");
+        viruses.push_back(random_bytes(rng, rng.uniform(min_virus, max_virus)));
+        if (!write_file((virus_dir / virus_names.back()).string(), viruses.back())) {
+            return false;
+        }
+    }
+
+    // The engines print paths as they see them under the hard-coded "data/" root
+    std::string print_prefix = "data/software_antivirus/" + tree_name + "/";
+    std::vector<std::string> relative_paths(file_count);
+    ull total_bytes = 0, infected = 0;
+    std::vector<std::string> contents(file_count);
+    for (ull f = 0; f < file_count; ++f) {
+        std::string rel;
+        ull depth = rng.uniform(0, max_dir_depth);
+        for (ull d = 0; d < depth; ++d) {
+            rel += "dir" + std::to_string(rng.uniform(0, 7)) + "/";
+        }
+        bool binary = rng.chance(binary_fraction);
+        rel += "file" + std::to_string(f) + (binary ? ".bin" : ".txt");
+
+        ull size = rng.log_uniform(min_size, max_size);
+        std::string content = binary ? random_bytes(rng, size) : random_string(rng, source_alphabet, size);
+        if (virus_count > 0 && rng.chance(infected_fraction)) {
+            ull plants = rng.uniform(1, 3);
+            for (ull p = 0; p < plants; ++p) {
+                const std::string& virus = viruses[rng.uniform(0, virus_count - 1)];
+                content.insert(rng.uniform(0, content.size()), virus);
+            }
+            infected++;
+        }
+
+        fs::create_directories((tree / rel).parent_path());
+        if (!write_file((tree / rel).string(), content)) {
+            return false;
+        }
+        total_bytes += content.size();
+        relative_paths[f] = rel;
+        contents[f] = std::move(content);
+    }
+
+    // Expected answers are derived from the written bytes, so accidental matches are included too
+    std::vector<std::string> lines(file_count);
+    #pragma omp parallel for schedule(dynamic)
+    for (ull f = 0; f < file_count; ++f) {
+        std::string line;
+        for (ull v = 0; v < virus_count; ++v) {
+            if (contents[f].find(viruses[v]) != std::string::npos) {
+                line += " " + virus_names[v];
+            }
+        }
+        if (!line.empty()) {
+            lines[f] = print_prefix + relative_paths[f] + line;
+        }
+    }
+    lines.erase(std::remove(lines.begin(), lines.end(), std::string()), lines.end());
+    std::sort(lines.begin(), lines.end());
+    std::string expected;
+    for (const auto& line : lines) {
+        expected += line + "\n";
+    }
+    if (!write_file((out / "software_antivirus" / "expected.txt").string(), expected)) {
+        return false;
+    }
+    std::cout << "software_antivirus: " << file_count << " files, " << total_bytes << " bytes, "
+              << virus_count << " signatures, " << infected << " infected files" << std::endl;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (opts.has("help")) {
+        std::cout << "Usage: gen_data [--out=./data] [--seed=N] [--scale=X] [--only=document|antivirus] [--force]\n"
+                     "  document:  --doc-size=300M --line-length=80 --alphabet=... --patterns=100\n"
+                     "             --min-pattern-length=4 --max-pattern-length=32 --prefix-share=0.3 --hit-density=0.1\n"
+                     "  antivirus: --files=8000 --min-file-size=64 --max-file-size=128K --binary-fraction=0.1\n"
+                     "             --max-dir-depth=3 --viruses=10 --min-virus-size=64 --max-virus-size=4K\n"
+                     "             --infected-fraction=0.002 --tree-name=opencv-4.10.0" << std::endl;
+        return 0;
+    }
+#ifdef VERBOSE
+    double start_time = omp_get_wtime();
+#endif
+    fs::path out = opts.get("out", "./data");
+    ull seed = opts.get_ull("seed", 42);
+    std::string only = opts.get("only", "");
+
+    // Each scenario draws from its own stream so regenerating one does not perturb the other
+    if (only.empty() || only == "document") {
+        Rng rng(seed);
+        if (!generate_document(rng, opts, out)) {
+            return 1;
+        }
+    }
+    if (only.empty() || only == "antivirus") {
+        Rng rng(seed ^ 0x9e3779b97f4a7c15ULL);
+        if (!generate_antivirus(rng, opts, out)) {
+            return 1;
+        }
+    }
+
+#ifdef VERBOSE
+    double end_time = omp_get_wtime();
+    std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
+#endif
+    return 0;
+}
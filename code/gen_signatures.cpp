@@ -0,0 +1,177 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include "cli.h"
+#include "dfa.h"
+#include "signature.h"
+#include "trie.h"
+
+namespace fs = std::filesystem;
+
+typedef unsigned long long ull;
+
+// Compiles a signature directory into a header with the dense Aho-Corasick DFA as constexpr
+// arrays, for antivirus_embedded (see `make embedded`). The header holds:
+//   STATES, CLASSES, MATCH     table shape; State is uint16_t when the states fit, else uint32_t
+//   BYTE_CLASS[256]            byte -> column
+//   DELTA[STATES * CLASSES]    next state, with MATCH set if the state reports signatures
+//   OUTPUT_BEGIN[STATES + 1]   per state, the range of OUTPUT holding every signature it reports
+//   OUTPUT[]                   indices into NAMES (suffix matches and duplicates expanded)
+//   NAMES[]                    signature file names
+// Only exact signatures can be embedded: a directory with wildcard signatures (*.sig) is rejected,
+// as the tables have no place for the gap checks.
+
+std::string read_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::string buffer(size, ' ');
+    if (!file.read(&buffer[0], size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return "";
+    }
+
+    return buffer;
+}
+
+std::vector<std::string> get_all_files(const std::string& directory) {
+    std::vector<std::string> files;
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Function to write `values` as the body of a braced initializer, 16 per line
+template <typename T>
+void write_values(std::ostream& out, const std::vector<T>& values) {
+    for (size_t i = 0; i < values.size(); ++i) {
+        out << (i % 16 == 0 ? "\n    " : " ") << static_cast<ull>(values[i]) << ",";
+    }
+    out << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    std::string virus_directory = opts.get("virus-dir", "data/software_antivirus/virus/");
+    std::string header = opts.get("output", "build/embedded_signatures.h");
+    ull max_entries = opts.get_ull("max-entries", 64 << 20);
+
+    if (!fs::is_directory(virus_directory)) {
+        std::cerr << "Error opening directory: " << virus_directory << std::endl;
+        return 1;
+    }
+    std::vector<std::string> pattern_files = get_all_files(virus_directory);
+    std::vector<std::string> signatures(pattern_files.size());
+    for (size_t i = 0; i < pattern_files.size(); ++i) {
+        if (is_wildcard_signature(pattern_files[i])) {
+            std::cerr << "Wildcard signatures cannot be embedded: " << pattern_files[i] << std::endl;
+            return 1;
+        }
+        signatures[i] = read_file(pattern_files[i]);
+    }
+    Trie trie(HUGE_OFF);
+    trie.set_alphabet(signatures);
+    for (size_t i = 0; i < signatures.size(); ++i) {
+        if (!signatures[i].empty()) {
+            trie.insert(signatures[i], i);
+        }
+    }
+    Dfa dfa(trie, -1, HUGE_OFF);
+    size_t states = dfa.state_count();
+    size_t classes = dfa.byte_classes();
+    if (states * classes > max_entries) {
+        std::cerr << "Automaton too large to embed: " << states << " states x " << classes
+                  << " classes (--max-entries=" << max_entries << ")" << std::endl;
+        return 1;
+    }
+    bool narrow = states < (1u << 15);
+    ull match = narrow ? 1u << 15 : Dfa::MATCH;
+
+    // One representative byte per column reads the DFA row through step()
+    std::vector<uint16_t> byte_class(256);
+    std::vector<int> representative(classes, -1);
+    for (int c = 0; c < 256; ++c) {
+        byte_class[c] = trie.byte_class(static_cast<unsigned char>(c));
+        if (representative[byte_class[c]] < 0) {
+            representative[byte_class[c]] = c;
+        }
+    }
+    std::vector<uint32_t> delta(states * classes, 0);
+    std::vector<uint32_t> output_begin(states + 1, 0);
+    std::vector<uint32_t> output;
+    for (size_t s = 0; s < states; ++s) {
+        for (size_t cls = 0; cls < classes; ++cls) {
+            uint32_t next = representative[cls] < 0 ? 0 : dfa.step(static_cast<uint32_t>(s), static_cast<unsigned char>(representative[cls]));
+            delta[s * classes + cls] = (next & ~Dfa::MATCH) | ((next & Dfa::MATCH) ? static_cast<uint32_t>(match) : 0);
+        }
+        output_begin[s] = static_cast<uint32_t>(output.size());
+        if (s != 0) {
+            dfa.for_each_match(static_cast<uint32_t>(s), [&](ull pattern, ull) {
+                trie.for_each_duplicate(pattern, [&](ull duplicate) {
+                    output.push_back(static_cast<uint32_t>(duplicate));
+                });
+            });
+        }
+    }
+    output_begin[states] = static_cast<uint32_t>(output.size());
+
+    std::error_code error;
+    if (fs::path(header).has_parent_path()) {
+        fs::create_directories(fs::path(header).parent_path(), error);
+    }
+    std::ofstream out(header, std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Error opening file: " << header << std::endl;
+        return 1;
+    }
+    out << "// Generated by gen_signatures from " << virus_directory << ", do not edit\n"
+        << "#ifndef EMBEDDED_SIGNATURES_H\n#define EMBEDDED_SIGNATURES_H\n\n"
+        << "#include <cstddef>\n#include <cstdint>\n\n"
+        << "namespace embedded {\n\n"
+        << "using State = " << (narrow ? "uint16_t" : "uint32_t") << ";\n"
+        << "constexpr size_t STATES = " << states << ";\n"
+        << "constexpr size_t CLASSES = " << classes << ";\n"
+        << "constexpr State MATCH = " << match << ";\n\n"
+        << "constexpr uint16_t BYTE_CLASS[256] = {";
+    write_values(out, byte_class);
+    out << "};\n\nalignas(64) constexpr State DELTA[STATES * CLASSES] = {";
+    write_values(out, delta);
+    out << "};\n\nconstexpr uint32_t OUTPUT_BEGIN[STATES + 1] = {";
+    write_values(out, output_begin);
+    out << "};\n\nconstexpr uint32_t OUTPUT[" << std::max<size_t>(1, output.size()) << "] = {";
+    write_values(out, output.empty() ? std::vector<uint32_t>{0} : output);
+    out << "};\n\nconstexpr const char* NAMES[" << std::max<size_t>(1, pattern_files.size()) << "] = {";
+    for (size_t i = 0; i < pattern_files.size(); ++i) {
+        std::string name = fs::path(pattern_files[i]).filename().string();
+        out << "\n    \"";
+        for (char ch : name) {
+            out << (ch == '"' || ch == '\\' ? "\\" : "") << ch;
+        }
+        out << "\",";
+    }
+    if (pattern_files.empty()) {
+        out << "\"\"";
+    }
+    out << "\n};\nconstexpr size_t NAME_COUNT = " << pattern_files.size() << ";\n\n"
+        << "} // namespace embedded\n\n#endif // EMBEDDED_SIGNATURES_H\n";
+    if (!out) {
+        std::cerr << "Error writing file: " << header << std::endl;
+        return 1;
+    }
+    std::cerr << "embedded: " << pattern_files.size() << " signatures, " << states << " states x " << classes
+              << " classes (" << states * classes * (narrow ? 2 : 4) << " bytes of table) -> " << header << std::endl;
+    return 0;
+}
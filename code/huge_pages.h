@@ -0,0 +1,159 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+// Huge-page backed memory for the large text buffers and the trie transition tables, to cut the dTLB
+// misses of random walks over hundreds of MB. Policies (--hugepages=...):
+//   off   plain 4 KB pages
+//   thp   2 MB aligned anonymous mapping + madvise(MADV_HUGEPAGE) (transparent huge pages)
+//   2m    MAP_HUGETLB with 2 MB pages from the reserved pool, falling back to thp
+//   1g    MAP_HUGETLB with 1 GB pages, falling back to 2m and thp
+//   auto  same as 2m (default)
+// Every fallback is silent; count_huge_pages() tells how many huge pages a mapping really got.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include <linux/mman.h>
+
+typedef unsigned long long ull;
+
+enum HugePagePolicy { HUGE_OFF, HUGE_THP, HUGE_2M, HUGE_1G };
+
+inline HugePagePolicy parse_huge_page_policy(const std::string& name) {
+    if (name == "off") return HUGE_OFF;
+    if (name == "thp") return HUGE_THP;
+    if (name == "1g") return HUGE_1G;
+    if (name != "2m" && name != "auto" && !name.empty()) {
+        std::cerr << "Unknown huge page policy: " << name << ", using auto" << std::endl;
+    }
+    return HUGE_2M;
+}
+
+const size_t HUGE_2M_SIZE = 2ULL << 20;
+const size_t HUGE_1G_SIZE = 1ULL << 30;
+
+struct Mapping {
+    char* data = nullptr;
+    size_t size = 0;       // usable bytes
+    size_t mapped = 0;     // bytes actually mapped (rounded up to the page size)
+    size_t page_size = 0;  // explicit hugetlb page size, 0 for normal / THP mappings
+    bool thp = false;
+};
+
+inline size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Maps `size` bytes without touching them
+inline Mapping map_memory(size_t size, HugePagePolicy policy) {
+    Mapping m;
+    m.size = size;
+    if (size == 0) {
+        return m;
+    }
+
+    if (policy == HUGE_1G || policy == HUGE_2M) {
+        size_t page = policy == HUGE_1G ? HUGE_1G_SIZE : HUGE_2M_SIZE;
+        int page_flag = policy == HUGE_1G ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+        void* p = mmap(nullptr, round_up(size, page), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag, -1, 0);
+        if (p != MAP_FAILED) {
+            m.data = static_cast<char*>(p);
+            m.mapped = round_up(size, page);
+            m.page_size = page;
+            return m;
+        }
+        if (policy == HUGE_1G) {
+            return map_memory(size, HUGE_2M);
+        }
+    }
+
+    if (policy != HUGE_OFF && size >= HUGE_2M_SIZE) {
+        // Over-allocate so that the region can start on a 2 MB boundary, then trim both ends
+        size_t length = round_up(size, HUGE_2M_SIZE);
+        void* p = mmap(nullptr, length + HUGE_2M_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            uintptr_t raw = reinterpret_cast<uintptr_t>(p);
+            uintptr_t aligned = round_up(raw, HUGE_2M_SIZE);
+            if (aligned > raw) {
+                munmap(p, aligned - raw);
+            }
+            size_t tail = raw + length + HUGE_2M_SIZE - (aligned + length);
+            if (tail > 0) {
+                munmap(reinterpret_cast<void*>(aligned + length), tail);
+            }
+            m.data = reinterpret_cast<char*>(aligned);
+            m.mapped = length;
+            m.thp = madvise(m.data, length, MADV_HUGEPAGE) == 0;
+            return m;
+        }
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+        m.data = static_cast<char*>(p);
+        m.mapped = size;
+    }
+    return m;
+}
+
+inline void unmap_memory(Mapping& m) {
+    if (m.data != nullptr) {
+        munmap(m.data, m.mapped);
+    }
+    m = Mapping();
+}
+
+// Huge pages backing a mapping: exact for hugetlb, from /proc/self/smaps (AnonHugePages) for THP
+inline ull count_huge_pages(const Mapping& m) {
+    if (m.data == nullptr) {
+        return 0;
+    }
+    if (m.page_size > 0) {
+        return m.mapped / m.page_size;
+    }
+    std::ifstream smaps("/proc/self/smaps");
+    uintptr_t begin = reinterpret_cast<uintptr_t>(m.data);
+    uintptr_t end = begin + m.mapped;
+    ull kb = 0;
+    bool inside = false;
+    for (std::string line; std::getline(smaps, line);) {
+        uintptr_t lo, hi;
+        char dash;
+        std::istringstream fields(line);
+        if (line.find(':') == std::string::npos || line.find(':') > line.find(' ')) {
+            // "lo-hi perms ..." header of a VMA
+            if (fields >> std::hex >> lo >> dash >> hi) {
+                inside = lo < end && hi > begin;
+            }
+            continue;
+        }
+        if (inside && line.rfind("AnonHugePages:", 0) == 0) {
+            ull value;
+            std::string name;
+            fields >> name >> value;
+            kb += value;
+        }
+    }
+    return kb * 1024 / HUGE_2M_SIZE;
+}
+
+inline std::string describe_mapping(const Mapping& m) {
+    std::ostringstream out;
+    out << m.size << " bytes, " << count_huge_pages(m) << " huge pages";
+    if (m.page_size > 0) {
+        out << " (hugetlb " << (m.page_size >> 20) << " MB)";
+    } else if (m.thp) {
+        out << " (transparent, 2 MB)";
+    } else {
+        out << " (4 KB pages)";
+    }
+    return out.str();
+}
+
+#endif // HUGE_PAGES_H
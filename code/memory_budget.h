@@ -0,0 +1,123 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+// Memory accounting and an optional hard budget (--memory-budget=SIZE, K/M/G suffixes).
+//
+// The pattern structures are charged once when they are built. Input buffers are acquired
+// before they are filled and released when the file is done: acquire() blocks until the bytes
+// fit under the budget, in arrival order, so one large file waits for room instead of starving
+// behind a stream of small ones. Results are only tracked. Every use keeps its current and peak
+// bytes, and the peak of the total is what --memory-report prints against the budget. A budget
+// of 0 means unlimited: nothing blocks, but the accounting is still done.
+
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+typedef unsigned long long ull;
+
+enum MemoryUse { MEMORY_PATTERNS, MEMORY_AUTOMATON, MEMORY_INPUT, MEMORY_RESULTS, NUM_MEMORY_USES };
+
+const char* const MEMORY_USE_NAMES[NUM_MEMORY_USES] = {"patterns", "automaton", "input", "results"};
+
+class MemoryBudget {
+public:
+    explicit MemoryBudget(ull limit = 0) : limit_(limit) {}
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    ull limit() const { return limit_; }
+    bool limited() const { return limit_ > 0; }
+
+    // Bytes left for acquire() once the charged structures are paid for
+    ull available() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return limited() ? limit_ - std::min(limit_, charged_) : static_cast<ull>(-1);
+    }
+
+    // Charges bytes held for the whole run; returns false if they do not fit under the budget
+    bool charge(MemoryUse use, ull bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        charged_ += bytes;
+        add(use, bytes);
+        return !limited() || charged_ <= limit_;
+    }
+
+    // Blocks until `bytes` fit next to everything else held, in FIFO order; returns true if it
+    // had to wait. The caller keeps a request within available(), otherwise it would never fit
+    bool acquire(MemoryUse use, ull bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ull ticket = next_ticket_++;
+        bool waited = false;
+        while (ticket != serving_ || (limited() && in_use_ + bytes > limit_)) {
+            waited = true;
+            changed_.wait(lock);
+        }
+        serving_++;
+        waits_ += waited ? 1 : 0;
+        add(use, bytes);
+        changed_.notify_all();
+        return waited;
+    }
+
+    void release(MemoryUse use, ull bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_[use] -= bytes;
+        in_use_ -= bytes;
+        changed_.notify_all();
+    }
+
+    // Accounts bytes that are not admitted (they cannot be delayed); release() them as usual
+    void track(MemoryUse use, ull bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        add(use, bytes);
+    }
+
+    ull peak(MemoryUse use) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return peak_[use];
+    }
+
+    ull peak_total() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return peak_total_;
+    }
+
+    ull admission_waits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return waits_;
+    }
+
+    // One line with the peak of every use and of the total, against the budget
+    void report(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out << "memory:";
+        for (int use = 0; use < NUM_MEMORY_USES; ++use) {
+            out << " " << MEMORY_USE_NAMES[use] << " " << peak_[use];
+        }
+        out << ", peak total " << peak_total_ << " bytes";
+        if (limited()) {
+            out << " of a " << limit_ << " byte budget, " << waits_ << " admission waits";
+        }
+        out << std::endl;
+    }
+
+private:
+    void add(MemoryUse use, ull bytes) {
+        current_[use] += bytes;
+        in_use_ += bytes;
+        peak_[use] = std::max(peak_[use], current_[use]);
+        peak_total_ = std::max(peak_total_, in_use_);
+    }
+
+    ull limit_;
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    ull charged_ = 0, in_use_ = 0, peak_total_ = 0, waits_ = 0;
+    ull next_ticket_ = 0, serving_ = 0;
+    ull current_[NUM_MEMORY_USES] = {}, peak_[NUM_MEMORY_USES] = {};
+};
+
+#endif // MEMORY_BUDGET_H
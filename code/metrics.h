@@ -0,0 +1,234 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Live progress metrics for long scans (--metrics=stderr|<file>, --metrics-interval=SECONDS).
+//
+//   Metrics metrics(opts.get("metrics", ""), opts.get_double("metrics-interval", 1), "antivirus", num_threads);
+//   metrics.set_tasks(files.size());
+//   metrics.add(thread, FILES, 1);     // from the thread that owns slot `thread`
+//   metrics.stop();                    // final report
+//
+// Every thread owns a cache-line-aligned slot of counters that only it writes (relaxed atomic
+// load + store, no read-modify-write, no lock), and a reporter thread sums the slots every
+// interval. The drivers update them once per file or chunk, never per byte, so the cost is a few
+// stores and clock reads per task. With no --metrics nothing is started and add() returns at once.
+//
+// "stderr" prints one status line per interval; any other value is a file rewritten with the
+// Prometheus text format (written to <file>.tmp and renamed, so a scraper or node_exporter's
+// textfile collector never sees half a file), with per-thread series to spot imbalance.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+
+typedef unsigned long long ull;
+
+enum Metric { BYTES, FILES, TASKS_TAKEN, HITS, IO_NS, MATCH_NS, NUM_METRICS };
+
+const char* const METRIC_NAMES[NUM_METRICS] = {
+    "bytes_scanned_total", "files_done_total", "tasks_taken_total", "hits_total", "io_seconds_total", "match_seconds_total"
+};
+
+const char* const METRIC_HELP[NUM_METRICS] = {
+    "Bytes of input scanned", "Input files finished", "Work items (files or chunks) taken from the queue",
+    "Matches reported", "Time spent reading input", "Time spent matching"
+};
+
+struct alignas(64) MetricSlot {
+    std::atomic<ull> values[NUM_METRICS] = {};
+};
+
+class Metrics {
+public:
+    Metrics(const std::string& target, double interval, const std::string& job, ull num_threads)
+        : target_(target), job_(job), interval_(std::max(0.01, interval)), slots_(target.empty() ? 0 : num_threads),
+          start_(std::chrono::steady_clock::now()) {
+        if (!target_.empty()) {
+            reporter_ = std::thread([this]() { run(); });
+        }
+    }
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    ~Metrics() {
+        stop();
+    }
+
+    bool enabled() const { return !target_.empty(); }
+
+    // Single writer per slot, so a relaxed load and store replace an atomic add
+    void add(ull thread, Metric metric, ull value) {
+        if (slots_.empty()) {
+            return;
+        }
+        std::atomic<ull>& counter = slots_[thread].values[metric];
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Queue depth is the number of tasks not yet taken
+    void set_tasks(ull tasks) { tasks_.store(tasks, std::memory_order_relaxed); }
+
+    // Name of the current phase (read, build, scan, merge, ...); a string literal
+    void set_phase(const char* phase) { phase_.store(phase, std::memory_order_relaxed); }
+
+    // Stops the reporter after one last report; the first call wins
+    void stop() {
+        if (!reporter_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        reporter_.join();
+    }
+
+    // Nanoseconds since `since`, for IO_NS / MATCH_NS; 0 without --metrics, so the clock is not read
+    ull elapsed_ns(std::chrono::steady_clock::time_point since) const {
+        return enabled() ? std::chrono::duration_cast<std::chrono::nanoseconds>(now() - since).count() : 0;
+    }
+
+    std::chrono::steady_clock::time_point now() const {
+        return enabled() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    }
+
+private:
+    struct Snapshot {
+        std::vector<std::vector<ull>> threads; // [thread][metric]
+        ull totals[NUM_METRICS] = {};
+        double seconds = 0;
+    };
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        snap.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        snap.threads.assign(slots_.size(), std::vector<ull>(NUM_METRICS, 0));
+        for (size_t t = 0; t < slots_.size(); ++t) {
+            for (int m = 0; m < NUM_METRICS; ++m) {
+                snap.threads[t][m] = slots_[t].values[m].load(std::memory_order_relaxed);
+                snap.totals[m] += snap.threads[t][m];
+            }
+        }
+        return snap;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto next = std::chrono::steady_clock::now();
+        double last_seconds = 0;
+        ull last_bytes = 0;
+        while (true) {
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval_));
+            bool stopping = wake_.wait_until(lock, next, [this]() { return stopping_; });
+            Snapshot snap = snapshot();
+            double rate = snap.seconds > last_seconds ? (snap.totals[BYTES] - last_bytes) / (snap.seconds - last_seconds) : 0;
+            if (target_ == "stderr") {
+                write_status(snap, rate);
+            } else {
+                write_prometheus(snap, rate);
+            }
+            last_seconds = snap.seconds;
+            last_bytes = snap.totals[BYTES];
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    ull queue_depth(const Snapshot& snap) const {
+        ull tasks = tasks_.load(std::memory_order_relaxed);
+        return tasks > snap.totals[TASKS_TAKEN] ? tasks - snap.totals[TASKS_TAKEN] : 0;
+    }
+
+    // One line: elapsed, phase, bytes and current rate, files, queue, hits, I/O share, and the
+    // least and most bytes any thread has scanned (a stalled thread stays behind)
+    void write_status(const Snapshot& snap, double rate) const {
+        ull least = snap.threads.empty() ? 0 : snap.threads[0][BYTES], most = least;
+        for (const auto& thread : snap.threads) {
+            least = std::min(least, thread[BYTES]);
+            most = std::max(most, thread[BYTES]);
+        }
+        ull busy = snap.totals[IO_NS] + snap.totals[MATCH_NS];
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1) << "[" << job_ << "] " << snap.seconds
+             << " s " << phase_.load(std::memory_order_relaxed) << ": " << snap.totals[BYTES] / 1e6 << " MB at "
+             << rate / 1e6 << " MB/s, " << snap.totals[FILES] << " files, queue " << queue_depth(snap) << ", "
+             << snap.totals[HITS] << " hits, io " << (busy > 0 ? 100.0 * snap.totals[IO_NS] / busy : 0)
+             << "%, thread bytes " << least / 1e6 << "-" << most / 1e6 << " MB\n";
+        std::cerr << line.str() << std::flush;
+    }
+
+    void write_prometheus(const Snapshot& snap, double rate) const {
+        std::string temporary = target_ + ".tmp";
+        std::ofstream out(temporary);
+        if (!out.is_open()) {
+            return;
+        }
+        std::string label = "job=\"" + job_ + "\"";
+        for (int m = 0; m < NUM_METRICS; ++m) {
+            std::string name = std::string("psm_") + METRIC_NAMES[m];
+            bool seconds = m == IO_NS || m == MATCH_NS;
+            out << "# HELP " << name << " " << METRIC_HELP[m] << "\n# TYPE " << name << " counter\n";
+            for (size_t t = 0; t < snap.threads.size(); ++t) {
+                out << name << "{" << label << ",thread=\"" << t << "\"} ";
+                if (seconds) {
+                    out << snap.threads[t][m] / 1e9 << "\n";
+                } else {
+                    out << snap.threads[t][m] << "\n";
+                }
+            }
+        }
+        out << "# HELP psm_queue_depth Work items not yet taken\n# TYPE psm_queue_depth gauge\n"
+            << "psm_queue_depth{" << label << "} " << queue_depth(snap) << "\n"
+            << "# HELP psm_bytes_per_second Scan rate over the last interval\n# TYPE psm_bytes_per_second gauge\n"
+            << "psm_bytes_per_second{" << label << "} " << rate << "\n"
+            << "# HELP psm_elapsed_seconds Time since start\n# TYPE psm_elapsed_seconds gauge\n"
+            << "psm_elapsed_seconds{" << label << "} " << snap.seconds << "\n"
+            << "# HELP psm_phase Current phase\n# TYPE psm_phase gauge\n"
+            << "psm_phase{" << label << ",phase=\"" << phase_.load(std::memory_order_relaxed) << "\"} 1\n";
+        out.close();
+        std::rename(temporary.c_str(), target_.c_str());
+    }
+
+    std::string target_, job_;
+    double interval_;
+    std::vector<MetricSlot> slots_;
+    std::atomic<ull> tasks_{0};
+    std::atomic<const char*> phase_{"start"};
+    std::chrono::steady_clock::time_point start_;
+    std::thread reporter_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+// Adds the time since construction to one metric of one slot
+class MetricTimer {
+public:
+    MetricTimer(Metrics& metrics, ull thread, Metric metric)
+        : metrics_(metrics), thread_(thread), metric_(metric), start_(metrics.now()) {}
+
+    ~MetricTimer() {
+        metrics_.add(thread_, metric_, metrics_.elapsed_ns(start_));
+    }
+
+private:
+    Metrics& metrics_;
+    ull thread_;
+    Metric metric_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif // METRICS_H
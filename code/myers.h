@@ -0,0 +1,140 @@
+#ifndef MYERS_H
+#define MYERS_H
+
+// Myers' bit-vector algorithm for approximate matching under edit distance: for a pattern of m
+// bytes, one column of the (semi-global) dynamic programming matrix is kept as vertical deltas in
+// bit vectors of ceil(m / 64) words, and each text byte updates the whole column with a handful
+// of word operations. After text[j], score() is the least edit distance between the pattern and
+// any substring ending at j. Bits above row m in the last word are never read, since carries only
+// run towards higher rows.
+//
+// myers_scan() runs one pattern over a range; myers_scan_lanes() steps K single-word patterns in
+// lockstep over the same bytes (like the DFA lanes, K independent dependency chains per thread).
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+typedef unsigned long long ull;
+
+struct MyersPattern {
+    size_t length = 0;
+    size_t words = 0;
+    std::vector<uint64_t> peq; // peq[c * words + w]: bit i set if pattern[64 w + i] == c
+
+    explicit MyersPattern(const std::string& pattern = "") : length(pattern.size()), words((pattern.size() + 63) / 64) {
+        peq.assign(256 * std::max<size_t>(1, words), 0);
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            peq[static_cast<unsigned char>(pattern[i]) * words + i / 64] |= 1ull << (i % 64);
+        }
+    }
+
+    // Bit of row m within the last word
+    uint64_t last_bit() const { return 1ull << ((length - 1) % 64); }
+};
+
+// Function to scan text[begin, end) and call on_end(j) for every j in [report_from, end) where the
+// pattern matches a substring ending at text[j] with at most k edits. Matches may start anywhere
+// from `begin` on, so a caller that needs every match ending at or after report_from starts at
+// least length + k bytes earlier
+template <typename OnEnd>
+void myers_scan(const MyersPattern& pattern, const char* text, ull begin, ull end, ull report_from, ull k, OnEnd on_end) {
+    if (pattern.length == 0) {
+        return;
+    }
+    const uint64_t last = pattern.last_bit();
+    ull score = pattern.length;
+    if (pattern.words == 1) {
+        uint64_t pv = ~0ull, mv = 0;
+        const uint64_t* peq = pattern.peq.data();
+        for (ull j = begin; j < end; ++j) {
+            uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            score += (ph & last) ? 1 : 0;
+            score -= (mh & last) ? 1 : 0;
+            ph <<= 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            if (score <= k && j >= report_from) {
+                on_end(j);
+            }
+        }
+        return;
+    }
+
+    // Blocks of 64 rows; the horizontal delta leaving the bottom of one block enters the next one
+    size_t words = pattern.words;
+    std::vector<uint64_t> pv(words, ~0ull), mv(words, 0);
+    for (ull j = begin; j < end; ++j) {
+        const uint64_t* peq = pattern.peq.data() + static_cast<unsigned char>(text[j]) * words;
+        int hin = 0; // row 0 is all zeros: a match may start anywhere
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t hin_neg = hin < 0 ? 1 : 0;
+            uint64_t eq = peq[w];
+            uint64_t xv = eq | mv[w];
+            eq |= hin_neg;
+            uint64_t xh = (((eq & pv[w]) + pv[w]) ^ pv[w]) | eq;
+            uint64_t ph = mv[w] | ~(xh | pv[w]);
+            uint64_t mh = pv[w] & xh;
+            uint64_t bottom = w + 1 == words ? last : 1ull << 63;
+            int hout = (ph & bottom) ? 1 : ((mh & bottom) ? -1 : 0);
+            ph = (ph << 1) | (hin > 0 ? 1 : 0);
+            mh = (mh << 1) | hin_neg;
+            pv[w] = mh | ~(xv | ph);
+            mv[w] = ph & xv;
+            hin = hout;
+        }
+        score += hin;
+        if (score <= k && j >= report_from) {
+            on_end(j);
+        }
+    }
+}
+
+// Function to scan text[begin, end) with K single-word patterns at once and call on_end(lane, j)
+// as myers_scan() would for each of them; lanes past `count` are idle
+template <int K, typename OnEnd>
+void myers_scan_lanes(const MyersPattern* const* patterns, int count, const char* text, ull begin, ull end,
+                      ull report_from, ull k, OnEnd on_end) {
+    uint64_t pv[K], mv[K], last[K];
+    ull score[K];
+    const uint64_t* peq[K];
+    for (int l = 0; l < K; ++l) {
+        const MyersPattern* pattern = patterns[l < count ? l : 0];
+        pv[l] = ~0ull;
+        mv[l] = 0;
+        last[l] = pattern->last_bit();
+        score[l] = pattern->length;
+        peq[l] = pattern->peq.data();
+    }
+    for (ull j = begin; j < end; ++j) {
+        unsigned char c = static_cast<unsigned char>(text[j]);
+        for (int l = 0; l < K; ++l) {
+            uint64_t eq = peq[l][c];
+            uint64_t xv = eq | mv[l];
+            uint64_t xh = (((eq & pv[l]) + pv[l]) ^ pv[l]) | eq;
+            uint64_t ph = mv[l] | ~(xh | pv[l]);
+            uint64_t mh = pv[l] & xh;
+            score[l] += (ph & last[l]) ? 1 : 0;
+            score[l] -= (mh & last[l]) ? 1 : 0;
+            ph <<= 1;
+            mh <<= 1;
+            pv[l] = mh | ~(xv | ph);
+            mv[l] = ph & xv;
+        }
+        if (j >= report_from) {
+            for (int l = 0; l < count; ++l) {
+                if (score[l] <= k) {
+                    on_end(l, j);
+                }
+            }
+        }
+    }
+}
+
+#endif // MYERS_H
@@ -0,0 +1,501 @@
+#ifndef ORACLE_H
+#define ORACLE_H
+
+// Differential correctness oracle shared by differential_check and the libFuzzer entry point:
+// a test case is materialized as a data/ tree, every engine binary is run on it, and the
+// normalized (sorted) output is compared with a straightforward reference matcher.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include "signature.h"
+
+namespace fs = std::filesystem;
+
+typedef unsigned long long ull;
+
+// CORPUS runs a document engine with --corpus on the document split into several files, WILDCARD
+// an antivirus engine with --virus-dir on the exact signatures plus the *.sig ones, STREAM a
+// streaming scan of the document printing "<offset> <pattern line>" per match, APPROX a document
+// engine reporting the end offsets of matches within --errors edits, EMBEDDED an antivirus engine
+// that has the signatures compiled in and is first built for the case (see build_embedded)
+enum Scenario { DOCUMENT, ANTIVIRUS, CORPUS, WILDCARD, STREAM, APPROX, EMBEDDED };
+
+struct Engine {
+    std::string name;
+    Scenario scenario;
+    std::string args;
+};
+
+// Every engine binary that the oracle knows how to drive
+inline std::vector<Engine> all_engines() {
+    return {
+        {"document_brute_force", DOCUMENT, ""},
+        {"document_brute_force_parallel", DOCUMENT, ""},
+        {"document_brute_force_parallel", DOCUMENT, "--mode=first-k --k=2"},
+        {"document_kmp", DOCUMENT, ""},
+        {"document_kmp_parallel", DOCUMENT, ""},
+        {"document_kmp_parallel", DOCUMENT, "--mode=exists"},
+        {"document_trie", DOCUMENT, ""},
+        {"document_trie_parallel", DOCUMENT, ""},
+        {"document_trie_parallel", DOCUMENT, "--pin=compact --replicate-trie"},
+        {"document_trie_parallel", DOCUMENT, "--pin=scatter --chunk-size=6 --two-pass"},
+        {"document_trie_parallel", DOCUMENT, "--engine=trie --alphabet=full"},
+        {"document_trie_parallel", DOCUMENT, "--lanes=1 --mode=count"},
+        {"document_trie_parallel", DOCUMENT, "--mode=first-k --k=3"},
+        {"document_trie_parallel", DOCUMENT, "--engine=trie --mode=exists"},
+        {"document_trie_parallel", DOCUMENT, "--lanes=8 --alphabet=full"},
+        {"document_trie_parallel", DOCUMENT, "--two-pass"},
+        {"document_trie_parallel", DOCUMENT, "--two-pass --engine=trie --lanes=2"},
+        {"document_trie_parallel", DOCUMENT, "--chunk-size=7"},
+        {"document_trie_parallel", DOCUMENT, "--chunk-size=3 --engine=trie --mode=first-k --k=2"},
+        {"document_trie_parallel", DOCUMENT, "--two-pass --chunk-size=5 --lanes=2"},
+        {"document_trie_parallel", DOCUMENT, "--chunk-size=0"},
+        {"document_trie_parallel", DOCUMENT, "--kernel=generic --mode=count"},
+        {"document_trie_parallel", DOCUMENT, "--alphabet=full --chunk-size=4 --mode=exists"},
+        {"document_trie_parallel", CORPUS, "--corpus=data/document_retrieval/corpus"},
+        {"document_trie_parallel", CORPUS, "--corpus=data/document_retrieval/corpus.txt --chunk-size=3 --mode=count"},
+        {"document_trie_parallel", CORPUS, "--corpus=data/document_retrieval/corpus --chunk-size=0 --engine=trie"},
+        {"document_index", DOCUMENT, ""},
+        {"document_index", DOCUMENT, "--rebuild"},
+        {"document_index", DOCUMENT, "--mode=count"},
+        {"document_index", DOCUMENT, "--mode=first-k --k=1"},
+        {"antivirus_brute_force", ANTIVIRUS, ""},
+        {"antivirus_brute_force_parallel", ANTIVIRUS, ""},
+        {"antivirus_brute_force_parallel", ANTIVIRUS, "--block-size=7"},
+        {"antivirus_kmp", ANTIVIRUS, ""},
+        {"antivirus_kmp_parallel", ANTIVIRUS, ""},
+        {"antivirus_kmp_parallel", ANTIVIRUS, "--block-size=5"},
+        {"antivirus_trie", ANTIVIRUS, ""},
+        {"antivirus_trie_parallel", ANTIVIRUS, ""},
+        {"antivirus_trie_parallel", ANTIVIRUS, "--engine=trie"},
+        {"antivirus_trie_parallel", ANTIVIRUS, "--lanes=8"},
+        {"antivirus_trie_parallel", ANTIVIRUS, "--kernel=generic --alphabet=full"},
+        {"antivirus_trie_parallel", ANTIVIRUS, "--alphabet=full --lanes=2"},
+        {"antivirus_trie_parallel", ANTIVIRUS, "--memory-budget=1G --window-size=7"},
+        {"antivirus_trie_parallel", ANTIVIRUS, "--memory-budget=1G --window-size=64 --engine=trie"},
+        {"antivirus_trie_parallel", WILDCARD, "--virus-dir=data/software_antivirus/wildcard/"},
+        {"antivirus_trie_parallel", WILDCARD, "--virus-dir=data/software_antivirus/wildcard/ --engine=trie --alphabet=full"},
+        {"antivirus_trie_parallel", WILDCARD, "--virus-dir=data/software_antivirus/wildcard/ --lanes=1"},
+        {"antivirus_trie_parallel", WILDCARD, "--virus-dir=data/software_antivirus/wildcard/ --memory-budget=1G --window-size=5"},
+        {"antivirus_shard", ANTIVIRUS, "--workers=3 --shard-size=64"},
+        {"antivirus_embedded", EMBEDDED, ""},
+        {"antivirus_shard", WILDCARD, "--virus-dir=data/software_antivirus/wildcard/ --workers=2 --shard-size=32"},
+        {"document_approx_parallel", APPROX, ""},
+        {"document_approx_parallel", APPROX, "--errors=0 --lanes=1"},
+        {"document_approx_parallel", APPROX, "--errors=2 --chunk-size=5 --mode=first-k --k=3"},
+        {"document_approx_parallel", APPROX, "--errors=1 --min-piece=100 --mode=count"},
+        {"document_approx_parallel", APPROX, "--errors=3 --chunk-size=7 --mode=exists"},
+        {"stream_scan", STREAM, "--buffer-size=3 < data/document_retrieval/document.txt"},
+        {"stream_scan", STREAM, "--input=data/document_retrieval/document.txt --buffer-size=1 --alphabet=full"},
+        {"auto_select", DOCUMENT, "document"},
+        {"auto_select", DOCUMENT, "document --mode=first-k --k=2"},
+        {"auto_select", ANTIVIRUS, "antivirus"},
+    };
+}
+
+struct TestCase {
+    // document retrieval: patterns must not contain '\n' (target.txt is line based)
+    std::string document;
+    std::vector<std::string> patterns;
+    // software antivirus: (relative path, content) and (virus file name, signature)
+    std::vector<std::pair<std::string, std::string>> files;
+    std::vector<std::pair<std::string, std::string>> viruses;
+    // wildcard signatures: (name ending in .sig, signature text), see signature.h
+    std::vector<std::pair<std::string, std::string>> wildcards;
+};
+
+const std::string ORACLE_TREE = "data/software_antivirus/opencv-4.10.0/";
+const std::string ORACLE_CORPUS = "data/document_retrieval/corpus/";
+const std::string ORACLE_WILDCARD = "data/software_antivirus/wildcard/";
+
+// The corpus of a case: the document cut in three (cuts may fall anywhere, also inside a pattern
+// occurrence) plus an empty file, in the order of their names
+inline std::vector<std::string> corpus_parts(const TestCase& tc) {
+    size_t third = tc.document.size() / 3;
+    return {tc.document.substr(0, third), tc.document.substr(third, third), tc.document.substr(2 * third), ""};
+}
+
+inline bool oracle_write(const fs::path& path, const std::string& content) {
+    fs::create_directories(path.parent_path());
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    return file.is_open() && file.write(content.data(), content.size());
+}
+
+inline bool materialize(const fs::path& dir, const TestCase& tc) {
+    fs::remove_all(dir / "data");
+    std::string targets;
+    for (const auto& pattern : tc.patterns) {
+        targets += pattern + "\n";
+    }
+    bool ok = oracle_write(dir / "data/document_retrieval/document.txt", tc.document) &&
+              oracle_write(dir / "data/document_retrieval/target.txt", targets);
+    fs::create_directories(dir / ORACLE_TREE);
+    fs::create_directories(dir / "data/software_antivirus/virus");
+    std::vector<std::string> parts = corpus_parts(tc);
+    std::string corpus_list;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        std::string path = ORACLE_CORPUS + "part" + std::to_string(i) + ".txt";
+        ok = ok && oracle_write(dir / path, parts[i]);
+        corpus_list += path + "\n";
+    }
+    ok = ok && oracle_write(dir / "data/document_retrieval/corpus.txt", corpus_list);
+    for (const auto& [path, content] : tc.files) {
+        ok = ok && oracle_write(dir / ORACLE_TREE / path, content);
+    }
+    fs::create_directories(dir / ORACLE_WILDCARD);
+    for (const auto& [name, signature] : tc.viruses) {
+        ok = ok && oracle_write(dir / "data/software_antivirus/virus" / name, signature) &&
+             oracle_write(dir / ORACLE_WILDCARD / name, signature);
+    }
+    for (const auto& [name, signature] : tc.wildcards) {
+        ok = ok && oracle_write(dir / ORACLE_WILDCARD / name, signature);
+    }
+    return ok;
+}
+
+// Reference semantics for document retrieval: every occurrence of a non-empty pattern in the
+// newline-stripped document, reported as an offset into the stripped text
+inline std::vector<std::string> reference_document(const std::string& document, const std::vector<std::string>& patterns) {
+    std::string stripped;
+    for (char c : document) {
+        if (c != '\n') {
+            stripped.push_back(c);
+        }
+    }
+    std::vector<std::string> lines;
+    for (const auto& pattern : patterns) {
+        std::vector<ull> positions;
+        for (size_t pos = pattern.empty() ? std::string::npos : stripped.find(pattern); pos != std::string::npos; pos = stripped.find(pattern, pos + 1)) {
+            positions.push_back(pos);
+        }
+        std::string line = std::to_string(positions.size());
+        for (ull pos : positions) {
+            line += " " + std::to_string(pos);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// Whether parts[part..] of a wildcard signature occur from content[pos] on, trying every
+// alternative and every gap length
+inline bool wildcard_matches_at(const WildcardSignature& signature, size_t part, const std::string& content, ull pos) {
+    for (const auto& alternative : signature.parts[part].alternatives) {
+        if (content.compare(pos, alternative.size(), alternative) != 0) {
+            continue;
+        }
+        ull end = pos + alternative.size();
+        if (part + 1 == signature.parts.size()) {
+            if (end + signature.tail_min <= content.size()) {
+                return true;
+            }
+            continue;
+        }
+        const SignaturePart& next = signature.parts[part + 1];
+        for (ull gap = next.gap_min; gap <= next.gap_max && end + gap < content.size(); ++gap) {
+            if (wildcard_matches_at(signature, part + 1, content, end + gap)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Reference semantics for approximate retrieval: for every non-empty pattern, every offset e of
+// the stripped document such that some substring ending at e is within `errors` edits of the
+// pattern (plain dynamic programming, row 0 all zeros so a match may start anywhere)
+inline std::vector<std::string> reference_approx(const std::string& document, const std::vector<std::string>& patterns, ull errors) {
+    std::string stripped;
+    for (char c : document) {
+        if (c != '\n') {
+            stripped.push_back(c);
+        }
+    }
+    std::vector<std::string> lines;
+    for (const auto& pattern : patterns) {
+        std::vector<ull> ends;
+        std::vector<ull> column(pattern.size() + 1), previous(pattern.size() + 1);
+        for (size_t i = 0; i <= pattern.size(); ++i) {
+            column[i] = i;
+        }
+        for (size_t j = 0; j < stripped.size() && !pattern.empty(); ++j) {
+            previous.swap(column);
+            column[0] = 0;
+            for (size_t i = 1; i <= pattern.size(); ++i) {
+                column[i] = std::min({previous[i - 1] + (pattern[i - 1] != stripped[j]), previous[i] + 1, column[i - 1] + 1});
+            }
+            if (column[pattern.size()] <= errors) {
+                ends.push_back(j);
+            }
+        }
+        std::string line = std::to_string(ends.size());
+        for (ull end : ends) {
+            line += " " + std::to_string(end);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// Reference semantics for antivirus: a non-empty file is reported with every non-empty signature
+// it contains (with `wildcards`, also every *.sig signature matching somewhere); names are sorted
+// and so are the lines
+inline std::vector<std::string> reference_antivirus(const TestCase& tc, bool wildcards = false) {
+    std::vector<std::string> lines;
+    for (const auto& [path, content] : tc.files) {
+        std::vector<std::string> names;
+        for (const auto& [name, signature] : tc.viruses) {
+            if (!content.empty() && !signature.empty() && content.find(signature) != std::string::npos) {
+                names.push_back(name);
+            }
+        }
+        for (const auto& [name, text] : wildcards ? tc.wildcards : std::vector<std::pair<std::string, std::string>>()) {
+            WildcardSignature signature;
+            std::string error;
+            if (!parse_signature(text, signature, error)) {
+                continue;
+            }
+            for (ull pos = signature.parts[0].gap_min; pos < content.size(); ++pos) {
+                if (wildcard_matches_at(signature, 0, content, pos)) {
+                    names.push_back(name);
+                    break;
+                }
+            }
+        }
+        if (names.empty()) {
+            continue;
+        }
+        std::sort(names.begin(), names.end());
+        std::string line = ORACLE_TREE + path;
+        for (const auto& name : names) {
+            line += " " + name;
+        }
+        lines.push_back(line);
+    }
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+// Value of "--name=value" in an engine's argument string, `def` if absent
+inline std::string engine_arg(const std::string& args, const std::string& name, const std::string& def) {
+    std::istringstream in(args);
+    for (std::string token; in >> token;) {
+        if (token.rfind("--" + name + "=", 0) == 0) {
+            return token.substr(name.size() + 3);
+        }
+    }
+    return def;
+}
+
+// Reference document lines as an engine run with --mode / --k reports them (see query.h)
+inline std::vector<std::string> apply_query_mode(const std::vector<std::string>& lines, const std::string& args) {
+    std::string mode = engine_arg(args, "mode", "all");
+    ull k = std::stoull(engine_arg(args, "k", "10"));
+    if (mode == "all") {
+        return lines;
+    }
+    std::vector<std::string> projected;
+    for (const auto& line : lines) {
+        std::istringstream fields(line);
+        ull count;
+        fields >> count;
+        if (mode == "count") {
+            projected.push_back(std::to_string(count));
+        } else if (mode == "exists") {
+            projected.push_back(count > 0 ? "1" : "0");
+        } else {
+            std::string first = std::to_string(std::min(count, k));
+            ull pos;
+            for (ull i = 0; i < k && fields >> pos; ++i) {
+                first += " " + std::to_string(pos);
+            }
+            projected.push_back(first);
+        }
+    }
+    return projected;
+}
+
+// Reference corpus output: per part a header line (normalized to "#") and the part's lines
+inline std::vector<std::string> reference_corpus(const TestCase& tc, const std::string& args) {
+    std::vector<std::string> lines;
+    for (const auto& part : corpus_parts(tc)) {
+        lines.push_back("#");
+        for (const auto& line : apply_query_mode(reference_document(part, tc.patterns), args)) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+// Reference stream output: one "<offset> <pattern index>" line per match, sorted as text
+inline std::vector<std::string> reference_stream(const std::vector<std::string>& document_lines) {
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < document_lines.size(); ++i) {
+        std::istringstream fields(document_lines[i]);
+        ull count, pos;
+        fields >> count;
+        while (fields >> pos) {
+            lines.push_back(std::to_string(pos) + " " + std::to_string(i));
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+// Document engines must print positions in ascending order whatever the schedule, so those lines
+// are compared as printed. Antivirus engines emit file lines in scheduling order and names in
+// directory order, so they are compared on a canonical form: names sorted, lines sorted
+inline std::vector<std::string> normalize(Scenario scenario, const std::string& output) {
+    std::vector<std::string> lines;
+    std::istringstream in(output);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind("Execution time", 0) == 0) {
+            continue;
+        }
+        if (scenario != ANTIVIRUS && scenario != WILDCARD) {
+            lines.push_back(line.rfind("#", 0) == 0 ? "#" : line); // corpus header without its path
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string head;
+        fields >> head;
+        std::vector<std::string> names;
+        std::string name;
+        while (fields >> name) {
+            names.push_back(name);
+        }
+        std::sort(names.begin(), names.end());
+        for (const auto& n : names) {
+            head += " " + n;
+        }
+        lines.push_back(head);
+    }
+    if (scenario == ANTIVIRUS || scenario == WILDCARD || scenario == STREAM) {
+        std::sort(lines.begin(), lines.end());
+    }
+    return lines;
+}
+
+inline bool run_engine(const fs::path& binary, const fs::path& dir, const std::string& args, int threads, std::string& output) {
+    std::string command = "cd '" + dir.string() + "' && OMP_NUM_THREADS=" + std::to_string(threads) +
+                          " '" + binary.string() + "' " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr) {
+        return false;
+    }
+    output.clear();
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        output.append(buffer, n);
+    }
+    int status = pclose(pipe);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Function to build antivirus_embedded for the signatures of the case in `dir`, as `make embedded`
+// does: gen_signatures writes the table to dir/build, and the scanner source next to the binaries
+// (bin_dir/code) is compiled against it into dir/antivirus_embedded ($CXX, default g++)
+inline bool build_embedded(const fs::path& bin_dir, const fs::path& dir) {
+    std::string compiler = std::getenv("CXX") ? std::getenv("CXX") : "g++";
+    std::string command = "cd '" + dir.string() + "' && '" + (bin_dir / "gen_signatures").string() +
+                          "' --virus-dir=data/software_antivirus/virus/ --output=build/embedded_signatures.h >/dev/null 2>&1 && " +
+                          compiler + " -std=c++17 -fopenmp -Ibuild '" + (bin_dir / "code/antivirus_embedded.cpp").string() +
+                          "' -o antivirus_embedded >/dev/null 2>&1";
+    int status = std::system(command.c_str());
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Runs every engine on one case; returns the number of mismatching engine runs and describes
+// the first difference of each on `report`
+inline int check_case(const TestCase& tc, const fs::path& bin_dir, const fs::path& work_dir,
+                      const std::vector<Engine>& engines, const std::vector<int>& thread_counts, std::ostream& report) {
+    if (!materialize(work_dir, tc)) {
+        report << "cannot materialize test case in " << work_dir.string() << std::endl;
+        return 1;
+    }
+    std::vector<std::string> expected_document = reference_document(tc.document, tc.patterns);
+    std::vector<std::string> expected_antivirus = reference_antivirus(tc);
+    std::vector<std::string> expected_wildcard = reference_antivirus(tc, true);
+
+    int failures = 0;
+    for (const auto& engine : engines) {
+        fs::path binary = bin_dir / engine.name;
+        if (engine.scenario == EMBEDDED) {
+            if (!build_embedded(bin_dir, work_dir)) {
+                failures++;
+                report << engine.name << ": build failed" << std::endl;
+                continue;
+            }
+            binary = work_dir / engine.name;
+        }
+        const auto expected = engine.scenario == DOCUMENT ? apply_query_mode(expected_document, engine.args)
+                              : engine.scenario == CORPUS ? reference_corpus(tc, engine.args)
+                              : engine.scenario == WILDCARD ? expected_wildcard
+                              : engine.scenario == STREAM ? reference_stream(expected_document)
+                              : engine.scenario == APPROX ? apply_query_mode(reference_approx(tc.document, tc.patterns, std::stoull(engine_arg(engine.args, "errors", "1"))), engine.args)
+                              : expected_antivirus;
+        for (int threads : thread_counts) {
+            std::string output;
+            bool exited = run_engine(binary, work_dir, engine.args, threads, output);
+            std::vector<std::string> actual = normalize(engine.scenario == EMBEDDED ? ANTIVIRUS : engine.scenario, output);
+            if (exited && actual == expected) {
+                continue;
+            }
+            failures++;
+            report << engine.name << (engine.args.empty() ? "" : " " + engine.args) << " (" << threads << " threads): ";
+            if (!exited) {
+                report << "abnormal exit" << std::endl;
+                continue;
+            }
+            size_t i = 0;
+            while (i < actual.size() && i < expected.size() && actual[i] == expected[i]) {
+                i++;
+            }
+            report << "line " << i + 1 << " expected \"" << (i < expected.size() ? expected[i] : "<eof>")
+                   << "\" got \"" << (i < actual.size() ? actual[i] : "<eof>") << "\"" << std::endl;
+        }
+    }
+    return failures;
+}
+
+// Decodes arbitrary bytes into a test case (used by the fuzzer): byte 0 picks the pattern count,
+// each pattern is a length byte plus payload, and the remainder is both the document and,
+// split in up to four pieces, the antivirus file contents
+inline TestCase decode_case(const uint8_t* data, size_t size) {
+    TestCase tc;
+    size_t pos = 0;
+    size_t count = size > 0 ? data[pos++] % 8 : 0;
+    for (size_t p = 0; p < count && pos < size; ++p) {
+        size_t len = data[pos++] % 16;
+        len = std::min(len, size - pos);
+        std::string raw(reinterpret_cast<const char*>(data + pos), len);
+        pos += len;
+        std::string pattern = raw;
+        pattern.erase(std::remove(pattern.begin(), pattern.end(), '\n'), pattern.end());
+        tc.patterns.push_back(pattern);
+        if (std::find_if(tc.viruses.begin(), tc.viruses.end(), [&](const auto& v) { return v.second == raw; }) == tc.viruses.end()) {
+            tc.viruses.push_back({"virus0" + std::to_string(p) + ".bin", raw});
+        }
+    }
+    std::string rest(reinterpret_cast<const char*>(data + pos), size - pos);
+    tc.document = rest.empty() ? std::string("\n") : rest;
+    size_t pieces = 4;
+    size_t piece = (rest.size() + pieces - 1) / pieces;
+    for (size_t f = 0; f < pieces; ++f) {
+        size_t begin = std::min(rest.size(), f * piece);
+        tc.files.push_back({"dir" + std::to_string(f % 2) + "/file" + std::to_string(f), rest.substr(begin, piece)});
+    }
+    return tc;
+}
+
+#endif // ORACLE_H
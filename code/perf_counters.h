@@ -0,0 +1,227 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Optional hardware performance counters around the scan phases (build with `make PERF=1`).
+//
+//   PERF_SCOPE("scan");   // counts the enclosing block for the calling thread
+//   PERF_REPORT();        // prints per-phase, per-thread totals at the end of main
+//
+// Without PERF_COUNTERS both macros expand to nothing, so the default build has zero overhead.
+// At run time PERF_FORMAT=json switches the report to JSON and PERF_OUTPUT=<file> redirects it
+// (default: stderr, so the matching results on stdout stay untouched).
+
+#ifdef PERF_COUNTERS
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <omp.h>
+
+namespace perf {
+
+typedef unsigned long long ull;
+
+enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES, PAGE_FAULTS, NUM_COUNTERS };
+
+const char* const COUNTER_NAMES[NUM_COUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses", "page_faults"
+};
+
+inline perf_event_attr counter_attr(Counter counter) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const ull cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    switch (counter) {
+        case CYCLES:        attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case INSTRUCTIONS:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case L1D_MISSES:    attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_L1D | cache_read_miss; break;
+        case LLC_MISSES:    attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case DTLB_MISSES:   attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_DTLB | cache_read_miss; break;
+        case BRANCH_MISSES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        default:            attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+    }
+    return attr;
+}
+
+// Per-thread counter set, opened on first use and left running; a scope is the difference of two
+// reads, so scopes nest freely. Counters the machine does not expose (e.g. in a VM) stay at -1.
+struct ThreadCounters {
+    int fds[NUM_COUNTERS];
+
+    ThreadCounters() {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            perf_event_attr attr = counter_attr(static_cast<Counter>(c));
+            fds[c] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+
+    ~ThreadCounters() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    // Values scaled for multiplexing; unsupported counters read as 0
+    void read_all(ull out[NUM_COUNTERS]) const {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            ull buffer[3] = {0, 0, 0};
+            out[c] = 0;
+            if (fds[c] >= 0 && read(fds[c], buffer, sizeof(buffer)) == sizeof(buffer) && buffer[2] > 0) {
+                out[c] = static_cast<ull>(static_cast<double>(buffer[0]) * buffer[1] / buffer[2]);
+            }
+        }
+    }
+};
+
+inline ThreadCounters& thread_counters() {
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+struct Sample {
+    ull values[NUM_COUNTERS] = {};
+    ull calls = 0;
+    double seconds = 0;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::pair<std::string, int>, Sample> samples;
+    bool supported[NUM_COUNTERS] = {};
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+class Scope {
+public:
+    explicit Scope(const char* phase) : phase_(phase), thread_(omp_get_thread_num()) {
+        thread_counters().read_all(begin_);
+        start_ = omp_get_wtime();
+    }
+
+    ~Scope() {
+        double seconds = omp_get_wtime() - start_;
+        ull end[NUM_COUNTERS];
+        const ThreadCounters& counters = thread_counters();
+        counters.read_all(end);
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        Sample& sample = reg.samples[{phase_, thread_}];
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            sample.values[c] += end[c] - begin_[c];
+            reg.supported[c] = reg.supported[c] || counters.fds[c] >= 0;
+        }
+        sample.calls++;
+        sample.seconds += seconds;
+    }
+
+private:
+    const char* phase_;
+    int thread_;
+    ull begin_[NUM_COUNTERS];
+    double start_;
+};
+
+inline void report() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    // Per-phase totals over all threads, reported as thread -1 ("all"); its time is the slowest thread
+    std::map<std::pair<std::string, int>, Sample> rows = reg.samples;
+    for (const auto& [key, sample] : reg.samples) {
+        Sample& total = rows[{key.first, -1}];
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            total.values[c] += sample.values[c];
+        }
+        total.calls += sample.calls;
+        total.seconds = std::max(total.seconds, sample.seconds);
+    }
+
+    std::ofstream file;
+    const char* output = std::getenv("PERF_OUTPUT");
+    if (output != nullptr) {
+        file.open(output);
+    }
+    std::ostream& out = file.is_open() ? file : std::cerr;
+    const char* format = std::getenv("PERF_FORMAT");
+
+    if (format != nullptr && std::string(format) == "json") {
+        out << "[";
+        bool first = true;
+        for (const auto& [key, sample] : rows) {
+            out << (first ? "\n" : ",\n") << "  {\"phase\": \"" << key.first << "\", \"thread\": "
+                << (key.second < 0 ? "\"all\"" : std::to_string(key.second)) << ", \"calls\": " << sample.calls
+                << ", \"seconds\": " << sample.seconds;
+            for (int c = 0; c < NUM_COUNTERS; ++c) {
+                out << ", \"" << COUNTER_NAMES[c] << "\": ";
+                if (reg.supported[c]) {
+                    out << sample.values[c];
+                } else {
+                    out << "null";
+                }
+            }
+            out << "}";
+            first = false;
+        }
+        out << "\n]" << std::endl;
+        return;
+    }
+
+    out << std::left << std::setw(12) << "phase" << std::setw(8) << "thread" << std::right << std::setw(8) << "calls"
+        << std::setw(12) << "seconds";
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        out << std::setw(15) << COUNTER_NAMES[c];
+    }
+    out << std::setw(8) << "IPC" << std::endl;
+    for (const auto& [key, sample] : rows) {
+        out << std::left << std::setw(12) << key.first << std::setw(8) << (key.second < 0 ? "all" : std::to_string(key.second))
+            << std::right << std::setw(8) << sample.calls << std::setw(12) << std::fixed << std::setprecision(6) << sample.seconds;
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            if (reg.supported[c]) {
+                out << std::setw(15) << sample.values[c];
+            } else {
+                out << std::setw(15) << "n/a";
+            }
+        }
+        if (reg.supported[CYCLES] && reg.supported[INSTRUCTIONS] && sample.values[CYCLES] > 0) {
+            out << std::setw(8) << std::setprecision(2) << static_cast<double>(sample.values[INSTRUCTIONS]) / sample.values[CYCLES];
+        } else {
+            out << std::setw(8) << "n/a";
+        }
+        out << std::endl;
+    }
+}
+
+} // namespace perf
+
+#define PERF_CONCAT_INNER(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_INNER(a, b)
+#define PERF_SCOPE(phase) perf::Scope PERF_CONCAT(perf_scope_, __LINE__)(phase)
+#define PERF_REPORT() perf::report()
+
+#else
+
+#define PERF_SCOPE(phase) do {} while (0)
+#define PERF_REPORT() do {} while (0)
+
+#endif // PERF_COUNTERS
+
+#endif // PERF_COUNTERS_H
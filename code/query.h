@@ -0,0 +1,106 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+// Query modes of the document engines (--mode=...), and the per-pattern result they keep:
+//   all      every position (default)              "<count> <pos> <pos> ..."
+//   count    only the number of occurrences        "<count>"
+//   first-k  the k smallest positions (--k=10)     "<min(count, k)> <pos> ..." (ascending)
+//   exists   whether the pattern occurs at all     "1" or "0"
+// Only `all` stores every position; first-k keeps a bounded heap, the others just a counter.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include "cli.h"
+
+typedef unsigned long long ull;
+
+enum QueryMode { MODE_ALL, MODE_COUNT, MODE_FIRST_K, MODE_EXISTS };
+
+struct Query {
+    QueryMode mode = MODE_ALL;
+    ull k = 10;
+
+    explicit Query(const Options& opts) {
+        std::string name = opts.get("mode", "all");
+        if (name == "count") {
+            mode = MODE_COUNT;
+        } else if (name == "first-k") {
+            mode = MODE_FIRST_K;
+        } else if (name == "exists") {
+            mode = MODE_EXISTS;
+        } else if (name != "all") {
+            std::cerr << "Unknown query mode: " << name << ", reporting all positions" << std::endl;
+        }
+        k = opts.get_ull("k", 10);
+    }
+
+    // Number of hits after which a left-to-right scan of a single pattern may stop
+    ull enough() const {
+        return mode == MODE_EXISTS ? 1 : (mode == MODE_FIRST_K ? k : ULLONG_MAX);
+    }
+};
+
+// Result of one pattern (per thread, then merged)
+struct Hits {
+    ull count = 0;
+    std::vector<ull> positions; // all of them, or a max-heap of the k smallest for first-k
+
+    void add(ull pos, const Query& query) {
+        count++;
+        if (query.mode == MODE_ALL) {
+            positions.push_back(pos);
+        } else if (query.mode == MODE_FIRST_K && query.k > 0) {
+            if (positions.size() < query.k) {
+                positions.push_back(pos);
+                std::push_heap(positions.begin(), positions.end());
+            } else if (pos < positions.front()) {
+                std::pop_heap(positions.begin(), positions.end());
+                positions.back() = pos;
+                std::push_heap(positions.begin(), positions.end());
+            }
+        }
+    }
+
+    void merge(const Hits& other, const Query& query) {
+        if (query.mode == MODE_FIRST_K) {
+            for (ull pos : other.positions) {
+                add(pos, query);
+            }
+            count += other.count - other.positions.size();
+            return;
+        }
+        count += other.count;
+        positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+    }
+
+    void print(std::ostream& out, const Query& query) const {
+        std::vector<ull> sorted;
+        switch (query.mode) {
+            case MODE_COUNT:
+                out << count;
+                break;
+            case MODE_EXISTS:
+                out << (count > 0 ? 1 : 0);
+                break;
+            case MODE_FIRST_K:
+                sorted = positions;
+                std::sort(sorted.begin(), sorted.end());
+                out << sorted.size();
+                break;
+            default:
+                out << count;
+                break;
+        }
+        if (query.mode == MODE_ALL || query.mode == MODE_FIRST_K) {
+            for (auto pos : query.mode == MODE_ALL ? positions : sorted) {
+                out << " " << pos;
+            }
+        }
+        out << '\n';
+    }
+};
+
+#endif // QUERY_H
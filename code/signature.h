@@ -0,0 +1,378 @@
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+
+// Wildcard signatures: a virus file named *.sig holds a hex pattern instead of raw bytes.
+//   4d 5a 90      exact bytes (whitespace is ignored, hex digits in either case)
+//   ??            any one byte
+//   {n} {n-m}     a gap of n, or n to m, arbitrary bytes; {n-} and {-m} leave one end open
+//   (aa|bbcc)     one of several exact byte strings
+// A signature is compiled into parts, each a set of exact alternatives with the gap allowed
+// before it. Every alternative is inserted into the same automaton as the exact signatures, as a
+// fragment with its own pattern index, so the scan stays a single pass; GapChecker chains the
+// fragment hits of a file part by part under the gap constraints.
+// A file matches when some chain is complete, which only costs work when fragments do occur.
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+typedef unsigned long long ull;
+
+constexpr ull GAP_UNBOUNDED = static_cast<ull>(-1);
+
+struct SignaturePart {
+    std::vector<std::string> alternatives; // exact byte strings, any of which matches
+    ull gap_min = 0, gap_max = 0;          // bytes between the previous part and this one
+};
+
+// Parts in order; the gap before the first part and tail_min only require that many bytes before
+// the first and after the last part (the signature just has to occur somewhere in the file)
+struct WildcardSignature {
+    std::vector<SignaturePart> parts;
+    ull tail_min = 0;
+};
+
+inline bool is_wildcard_signature(const std::string& path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".sig") == 0;
+}
+
+// Function to parse the text of a *.sig file; returns false with a message in `error`
+inline bool parse_signature(const std::string& text, WildcardSignature& signature, std::string& error) {
+    signature = WildcardSignature();
+    size_t pos = 0;
+    auto skip_space = [&]() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) {
+            pos++;
+        }
+    };
+    auto fail = [&](const std::string& message) {
+        error = message + " at offset " + std::to_string(pos);
+        return false;
+    };
+    auto hex_byte = [&](std::string& out) {
+        auto digit = [](char c) { return std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : std::tolower(static_cast<unsigned char>(c)) - 'a' + 10; };
+        if (pos + 1 >= text.size() || !std::isxdigit(static_cast<unsigned char>(text[pos])) || !std::isxdigit(static_cast<unsigned char>(text[pos + 1]))) {
+            return false;
+        }
+        out.push_back(static_cast<char>(digit(text[pos]) * 16 + digit(text[pos + 1])));
+        pos += 2;
+        return true;
+    };
+    auto number = [&](ull& value) {
+        size_t begin = pos;
+        value = 0;
+        while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos]))) {
+            value = value * 10 + (text[pos++] - '0');
+        }
+        return pos > begin;
+    };
+
+    ull gap_min = 0, gap_max = 0; // gap pending before the next part
+    std::string literal;          // exact bytes of the part being read
+    auto add_gap = [&](ull lo, ull hi) {
+        gap_min += lo;
+        gap_max = gap_max == GAP_UNBOUNDED || hi == GAP_UNBOUNDED ? GAP_UNBOUNDED : gap_max + hi;
+    };
+    auto add_part = [&](std::vector<std::string> alternatives) {
+        signature.parts.push_back({std::move(alternatives), gap_min, gap_max});
+        gap_min = gap_max = 0;
+    };
+    auto flush_literal = [&]() {
+        if (!literal.empty()) {
+            add_part({literal});
+            literal.clear();
+        }
+    };
+
+    for (skip_space(); pos < text.size(); skip_space()) {
+        char c = text[pos];
+        if (c == '?') {
+            if (pos + 1 >= text.size() || text[pos + 1] != '?') {
+                return fail("expected ??");
+            }
+            flush_literal();
+            add_gap(1, 1);
+            pos += 2;
+        } else if (c == '{') {
+            flush_literal();
+            pos++;
+            ull lo = 0, hi = 0;
+            bool has_lo = number(lo);
+            if (pos < text.size() && text[pos] == '-') {
+                pos++;
+                hi = number(hi) ? hi : GAP_UNBOUNDED;
+            } else if (has_lo) {
+                hi = lo;
+            } else {
+                return fail("expected a gap length");
+            }
+            if (pos >= text.size() || text[pos] != '}') {
+                return fail("expected }");
+            }
+            if (hi < lo) {
+                return fail("empty gap range");
+            }
+            pos++;
+            add_gap(lo, hi);
+        } else if (c == '(') {
+            flush_literal();
+            pos++;
+            std::vector<std::string> alternatives(1);
+            for (skip_space(); pos < text.size() && text[pos] != ')'; skip_space()) {
+                if (text[pos] == '|') {
+                    alternatives.emplace_back();
+                    pos++;
+                } else if (!hex_byte(alternatives.back())) {
+                    return fail("expected a hex byte in alternation");
+                }
+            }
+            if (pos >= text.size()) {
+                return fail("expected )");
+            }
+            for (const auto& alternative : alternatives) {
+                if (alternative.empty()) {
+                    return fail("empty alternative");
+                }
+            }
+            pos++;
+            add_part(std::move(alternatives));
+        } else if (!hex_byte(literal)) {
+            return fail("expected a hex byte");
+        }
+    }
+    flush_literal();
+    if (signature.parts.empty()) {
+        return fail("signature has no exact bytes");
+    }
+    signature.tail_min = gap_min;
+    return true;
+}
+
+// The pattern set of a virus directory: exact signatures keep their file index as pattern index,
+// the fragments of the wildcard signatures are numbered after all files
+struct CompiledSignatures {
+    ull files = 0;
+    std::vector<std::string> patterns;               // by pattern index, "" for nothing to insert
+    std::vector<WildcardSignature> wildcards;
+    std::vector<ull> wildcard_file;                  // file index of every wildcard signature
+    std::vector<std::pair<ull, ull>> fragment_part;  // (wildcard, part) of pattern index files + i
+
+    bool is_fragment(ull index) const { return index >= files; }
+};
+
+// Function to compile the contents of the signature files; *.sig files are parsed as wildcard
+// signatures, everything else is an exact byte string. Returns false with a message in `error`
+inline bool compile_signatures(const std::vector<std::string>& paths, const std::vector<std::string>& contents,
+                               CompiledSignatures& compiled, std::string& error) {
+    compiled = CompiledSignatures();
+    compiled.files = paths.size();
+    compiled.patterns.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!is_wildcard_signature(paths[i])) {
+            compiled.patterns[i] = contents[i];
+            continue;
+        }
+        WildcardSignature signature;
+        if (!parse_signature(contents[i], signature, error)) {
+            error = paths[i] + ": " + error;
+            return false;
+        }
+        ull wildcard = compiled.wildcards.size();
+        for (ull part = 0; part < signature.parts.size(); ++part) {
+            for (const auto& alternative : signature.parts[part].alternatives) {
+                compiled.patterns.push_back(alternative);
+                compiled.fragment_part.push_back({wildcard, part});
+            }
+        }
+        compiled.wildcards.push_back(std::move(signature));
+        compiled.wildcard_file.push_back(i);
+    }
+    return true;
+}
+
+// Per-file state of the wildcard signatures: hit() records where a fragment starts, finish()
+// decides the file and resets. One checker per thread.
+//
+// A scan that reports hits in start or in end order (a single walk over the file) lets the
+// checker chain them as they come: every part keeps the ends of the chains through it, and an
+// end is dropped as soon as the next part's gap_max cannot reach a hit still to come, so a file
+// holds at most a gap's worth of ends per part however many fragments it contains. Interleaved
+// lanes report out of order; their hits are kept until finish() and chained there, and
+// held_bytes() lets the caller account for them
+class GapChecker {
+public:
+    explicit GapChecker(const CompiledSignatures& compiled) : compiled_(compiled) {
+        for (const auto& signature : compiled.wildcards) {
+            part_base_.push_back(hits_.size());
+            hits_.resize(hits_.size() + signature.parts.size());
+        }
+        live_.resize(hits_.size());
+        hit_parts_.assign(compiled.wildcards.size(), 0);
+        complete_.assign(compiled.wildcards.size(), NO_CHAIN);
+        marked_.assign(compiled.wildcards.size(), false);
+        for (ull i = compiled.files; i < compiled.patterns.size(); ++i) {
+            longest_ = std::max<ull>(longest_, compiled.patterns[i].size());
+        }
+    }
+
+    // Starts a file; `ordered` promises that its hits arrive in start or in end order
+    void begin(bool ordered) { ordered_ = ordered; }
+
+    // Records a match of fragment pattern `index` starting at offset `start`
+    void hit(ull index, ull start) {
+        auto [wildcard, part] = compiled_.fragment_part[index - compiled_.files];
+        ull end = start + compiled_.patterns[index].size();
+        if (ordered_) {
+            extend(wildcard, part, start, end);
+            return;
+        }
+        std::vector<std::pair<ull, ull>>& hits = hits_[part_base_[wildcard] + part];
+        if (hits.empty() && hit_parts_[wildcard]++ == 0) {
+            mark(wildcard);
+        }
+        hits.push_back({start, end});
+        held_ += sizeof(hits.back());
+    }
+
+    // Bytes of hits and chain ends held for the current file
+    ull held_bytes() const { return held_; }
+
+    // Calls f(file index) for every wildcard signature matched in a text of `size` bytes, then
+    // forgets the file. Kept hits are only chained for signatures whose every part was hit
+    template <typename F>
+    void finish(ull size, F f) {
+        for (ull wildcard : touched_) {
+            const WildcardSignature& signature = compiled_.wildcards[wildcard];
+            bool matched = ordered_ ? complete_[wildcard] != NO_CHAIN && complete_[wildcard] + signature.tail_min <= size
+                                    : hit_parts_[wildcard] == signature.parts.size() && chain(wildcard, size);
+            if (matched) {
+                f(compiled_.wildcard_file[wildcard]);
+            }
+            hit_parts_[wildcard] = 0;
+            complete_[wildcard] = NO_CHAIN;
+            marked_[wildcard] = false;
+            for (ull part = 0; part < signature.parts.size(); ++part) {
+                hits_[part_base_[wildcard] + part].clear();
+                live_[part_base_[wildcard] + part].clear();
+            }
+        }
+        touched_.clear();
+        held_ = 0;
+    }
+
+private:
+    static constexpr ull NO_CHAIN = static_cast<ull>(-1);
+
+    void mark(ull wildcard) {
+        if (!marked_[wildcard]) {
+            marked_[wildcard] = true;
+            touched_.push_back(wildcard);
+        }
+    }
+
+    // Hits still to come start at or after `start` - the longest fragment (whether they arrive
+    // in start or in end order), so ends before that minus `gap_max` can no longer be extended
+    void prune(std::deque<ull>& ends, ull gap_max, ull start) {
+        if (gap_max == GAP_UNBOUNDED || start < longest_ + gap_max) {
+            return;
+        }
+        while (!ends.empty() && ends.front() < start - longest_ - gap_max) {
+            ends.pop_front();
+            held_ -= sizeof(ull);
+        }
+    }
+
+    // Chains one hit in arrival order; the hits of the previous part that it needs end at or
+    // before its start, so they have arrived already
+    void extend(ull wildcard, ull part, ull start, ull end) {
+        const WildcardSignature& signature = compiled_.wildcards[wildcard];
+        ull slot = part_base_[wildcard] + part;
+        ull gap_min = signature.parts[part].gap_min, gap_max = signature.parts[part].gap_max;
+        if (start < gap_min) {
+            return;
+        }
+        if (part > 0) {
+            // Some chain must end in [start - gap_max, start - gap_min]
+            std::deque<ull>& previous = live_[slot - 1];
+            prune(previous, gap_max, start);
+            ull low = gap_max == GAP_UNBOUNDED || gap_max > start ? 0 : start - gap_max;
+            auto it = std::lower_bound(previous.begin(), previous.end(), low);
+            if (it == previous.end() || *it > start - gap_min) {
+                return;
+            }
+        }
+        mark(wildcard);
+        if (part + 1 == signature.parts.size()) {
+            complete_[wildcard] = std::min(complete_[wildcard], end);
+            return;
+        }
+        // Ends stay sorted and distinct; before an unbounded gap only the earliest one matters
+        std::deque<ull>& ends = live_[slot];
+        if (signature.parts[part + 1].gap_max == GAP_UNBOUNDED) {
+            if (ends.empty()) {
+                ends.push_back(end);
+                held_ += sizeof(ull);
+            } else {
+                ends.front() = std::min(ends.front(), end);
+            }
+            return;
+        }
+        auto it = std::lower_bound(ends.begin(), ends.end(), end);
+        if (it == ends.end() || *it != end) {
+            ends.insert(it, end);
+            held_ += sizeof(ull);
+        }
+        prune(ends, signature.parts[part + 1].gap_max, start);
+    }
+
+    // Ends of the chains through every part in turn: a hit of part p extends a chain ending at e
+    // if it starts within [e + gap_min, e + gap_max]
+    bool chain(ull wildcard, ull size) {
+        const WildcardSignature& signature = compiled_.wildcards[wildcard];
+        ends_.clear();
+        for (ull part = 0; part < signature.parts.size(); ++part) {
+            std::vector<std::pair<ull, ull>>& hits = hits_[part_base_[wildcard] + part];
+            ull gap_min = signature.parts[part].gap_min, gap_max = signature.parts[part].gap_max;
+            next_.clear();
+            for (const auto& [start, end] : hits) {
+                if (start < gap_min) {
+                    continue;
+                }
+                if (part == 0) {
+                    next_.push_back(end);
+                    continue;
+                }
+                // Some chain must end in [start - gap_max, start - gap_min]
+                ull low = gap_max == GAP_UNBOUNDED || gap_max > start ? 0 : start - gap_max;
+                auto it = std::lower_bound(ends_.begin(), ends_.end(), low);
+                if (it != ends_.end() && *it <= start - gap_min) {
+                    next_.push_back(end);
+                }
+            }
+            std::sort(next_.begin(), next_.end());
+            next_.erase(std::unique(next_.begin(), next_.end()), next_.end());
+            ends_.swap(next_);
+            if (ends_.empty()) {
+                return false;
+            }
+        }
+        return ends_.front() + signature.tail_min <= size;
+    }
+
+    const CompiledSignatures& compiled_;
+    std::vector<ull> part_base_;                          // per wildcard, its first slot in hits_
+    std::vector<std::vector<std::pair<ull, ull>>> hits_;  // per part: (start, end) of fragment hits
+    std::vector<std::deque<ull>> live_;                   // per part: ends of the chains through it
+    std::vector<size_t> hit_parts_;                       // per wildcard, parts with any hit
+    std::vector<ull> complete_;                           // per wildcard, earliest end of a full chain
+    std::vector<bool> marked_;                            // per wildcard, listed in touched_
+    std::vector<ull> touched_;
+    std::vector<ull> ends_, next_;
+    ull longest_ = 0, held_ = 0;                          // longest fragment, bytes held for the file
+    bool ordered_ = false;
+};
+
+#endif // SIGNATURE_H
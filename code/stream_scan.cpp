@@ -0,0 +1,210 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <omp.h>
+#include "cli.h"
+#include "dfa.h"
+#include "perf_counters.h"
+#include "signature.h"
+#include "trie.h"
+
+namespace fs = std::filesystem;
+
+typedef unsigned long long ull;
+
+// Streaming scan: the input is consumed in --buffer-size reads from stdin, --input=PATH (a pipe,
+// a FIFO, a device or a regular file, read front to back) or the connections to a Unix socket
+// (--socket=PATH), and every match is printed as soon as its last byte has been read:
+//   <offset> <pattern>
+// where offset is the start of the match in the stream and pattern the line number (from 0) in
+// --patterns=FILE (default data/document_retrieval/target.txt) or, with --virus-dir=DIR, the
+// signature file name. Pattern lines are matched as in document retrieval, newlines are skipped
+// and not counted (--raw counts them and matches them like any byte); signatures always match raw
+// bytes. Only the automaton state and offset are carried between reads, so memory and latency do
+// not depend on the stream length. Wildcard signatures (*.sig) are rejected: chaining their
+// fragments would mean keeping hits for an unbounded stretch of the stream.
+
+std::string read_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return "";
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::string buffer(size, ' ');
+    if (!file.read(&buffer[0], size)) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        return "";
+    }
+
+    return buffer;
+}
+
+std::vector<std::string> get_all_files(const std::string& directory) {
+    std::vector<std::string> files;
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Function to scan one stream until EOF; returns false on a read error
+bool scan_stream(int fd, StreamScanner& scanner, const Trie& trie, const std::vector<std::string>& names, std::vector<char>& buffer) {
+    scanner.reset();
+    std::string out;
+    while (true) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            std::cerr << "Error reading stream: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        scanner.feed(buffer.data(), static_cast<size_t>(n), [&](ull index, ull offset) {
+            trie.for_each_duplicate(index, [&](ull duplicate) {
+                out += std::to_string(offset) + " " + names[duplicate] + "\n";
+            });
+        });
+        // Matches of a buffer are written before the next read blocks
+        if (!out.empty()) {
+            std::cout << out << std::flush;
+            out.clear();
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+#ifdef VERBOSE
+    double start_time = omp_get_wtime();
+#endif
+    Options opts(argc, argv);
+    if (opts.has("help")) {
+        std::cout << "Usage: stream_scan [--patterns=FILE | --virus-dir=DIR] [--input=PATH | --socket=PATH [--connections=N]]\n"
+                     "                   [--buffer-size=64K] [--raw] [--alphabet=classes|full] [--hugepages=...]" << std::endl;
+        return 0;
+    }
+    HugePagePolicy huge_pages = parse_huge_page_policy(opts.get("hugepages", "auto"));
+
+    // Patterns: lines of a target file, or the signature files of a virus directory; empty
+    // patterns and files are skipped but keep their index
+    std::vector<std::string> patterns, names;
+    bool signatures = opts.has("virus-dir");
+    if (signatures) {
+        std::string directory = opts.get("virus-dir", "");
+        if (!fs::is_directory(directory)) {
+            std::cerr << "Error opening directory: " << directory << std::endl;
+            return 1;
+        }
+        for (const auto& path : get_all_files(directory)) {
+            if (is_wildcard_signature(path)) {
+                std::cerr << "Wildcard signatures are not supported in a stream: " << path << std::endl;
+                return 1;
+            }
+            patterns.push_back(read_file(path));
+            names.push_back(fs::path(path).filename().string());
+        }
+    } else {
+        std::string patternsfile = opts.get("patterns", "./data/document_retrieval/target.txt");
+        std::ifstream patterns_file(patternsfile);
+        if (!patterns_file.is_open()) {
+            std::cerr << "Error opening file: " << patternsfile << std::endl;
+            return 1;
+        }
+        for (std::string pattern; std::getline(patterns_file, pattern);) {
+            names.push_back(std::to_string(patterns.size()));
+            patterns.push_back(pattern);
+        }
+    }
+    bool skip_newlines = !signatures && !opts.has("raw");
+
+    Trie trie(huge_pages);
+    if (opts.get("alphabet", "classes") != "full") {
+        trie.set_alphabet(patterns);
+    }
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if (!patterns[i].empty()) {
+            trie.insert(patterns[i], i);
+        }
+    }
+    Dfa dfa(trie, skip_newlines ? '\n' : -1, huge_pages);
+    StreamScanner scanner(dfa, skip_newlines);
+    std::vector<char> buffer(std::max<ull>(1, opts.get_ull("buffer-size", 64 << 10)));
+
+    int status = 0;
+    if (opts.has("socket")) {
+        // Every connection is a stream of its own (offsets start at 0), announced by a "# <n>" line;
+        // connections are served one after the other, --connections=N stops after N of them
+        std::string path = opts.get("socket", "");
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: " << path << std::endl;
+            return 1;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(path.c_str());
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+            std::cerr << "Error listening on " << path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        ull limit = opts.get_ull("connections", 0);
+        for (ull served = 0; limit == 0 || served < limit;) {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Error accepting on " << path << ": " << std::strerror(errno) << std::endl;
+                status = 1;
+                break;
+            }
+            std::cout << "# " << served++ << std::endl;
+            if (!scan_stream(connection, scanner, trie, names, buffer)) {
+                status = 1;
+            }
+            close(connection);
+        }
+        close(listener);
+        unlink(path.c_str());
+    } else {
+        int fd = 0;
+        if (opts.has("input")) {
+            fd = open(opts.get("input", "").c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                std::cerr << "Error opening file: " << opts.get("input", "") << std::endl;
+                return 1;
+            }
+        }
+        status = scan_stream(fd, scanner, trie, names, buffer) ? 0 : 1;
+        if (fd != 0) {
+            close(fd);
+        }
+    }
+
+#ifdef VERBOSE
+    double end_time = omp_get_wtime();
+    std::cout << "Execution time: " << end_time - start_time << " seconds." << std::endl;
+#endif
+    PERF_REPORT();
+    return status;
+}
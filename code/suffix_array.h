@@ -0,0 +1,279 @@
+#ifndef SUFFIX_ARRAY_H
+#define SUFFIX_ARRAY_H
+
+// Suffix array over a fixed (newline-stripped) document, for answering many pattern batches
+// without rescanning the document.
+//
+// Construction is parallel prefix doubling with Larsson-Sadakane group refinement: suffixes start
+// in buckets of their first byte, and every round re-sorts only the groups that are still tied, by
+// the rank of the suffix k bytes further, doubling k. Each round is two parallel passes over the
+// tied groups (sort, then re-rank), so there is no serial phase besides the first bucket pass.
+// Memory is 9 bytes per text byte plus a sort buffer for the largest tied group.
+//
+// Queries are a binary search for the SA interval with the Manber-Myers lcp acceleration (the
+// comparison resumes at min(lcp with the left bound, lcp with the right bound)), which is
+// O(m + log n) in practice, plus O(occ) to read the positions.
+//
+// Index file: IndexHeader, the stripped text, padding to 8 bytes, then n uint32 SA entries. It is
+// mapped read-only, so opening it costs no time proportional to the document size.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <parallel/algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+
+typedef unsigned long long ull;
+
+// Builds the suffix array of `text` (n < 2^32 - 1)
+inline std::vector<uint32_t> build_suffix_array(std::string_view text) {
+    ull n = text.size();
+    std::vector<uint32_t> sa(n);
+    if (n == 0) {
+        return sa;
+    }
+
+    // rank[i] = 1 + first SA slot of the group of suffix i; 0 stands for "past the end", which
+    // sorts before everything, so shorter suffixes come first among equal prefixes
+    std::vector<uint32_t> rank(n);
+    std::vector<ull> bucket(257, 0);
+    for (unsigned char c : text) {
+        bucket[c + 1]++;
+    }
+    for (int c = 1; c <= 256; ++c) {
+        bucket[c] += bucket[c - 1];
+    }
+    std::vector<ull> fill(bucket.begin(), bucket.end() - 1);
+    for (ull i = 0; i < n; ++i) {
+        sa[fill[static_cast<unsigned char>(text[i])]++] = static_cast<uint32_t>(i);
+    }
+    std::vector<std::pair<ull, ull>> groups; // tied SA ranges [first, second)
+    for (int c = 0; c < 256; ++c) {
+        if (bucket[c + 1] - bucket[c] > 1) {
+            groups.push_back({bucket[c], bucket[c + 1]});
+        }
+    }
+    #pragma omp parallel for
+    for (ull i = 0; i < n; ++i) {
+        rank[i] = static_cast<uint32_t>(bucket[static_cast<unsigned char>(text[i])] + 1);
+    }
+
+    std::vector<uint8_t> split(n, 0);
+    int threads = omp_get_max_threads();
+    for (ull k = 1; !groups.empty() && k < n; k *= 2) {
+        // Pass 1: sort every tied group by the rank k bytes further and mark where the key changes.
+        // Ranks are only read here, so all groups see the ranks of the previous round
+        auto key_of = [&](uint32_t i) -> ull { return i + k < n ? rank[i + k] : 0; };
+        auto sort_group = [&](ull first, ull last, bool parallel) {
+            std::vector<ull> keyed(last - first);
+            for (ull j = first; j < last; ++j) {
+                keyed[j - first] = key_of(sa[j]) << 32 | sa[j];
+            }
+            if (parallel) {
+                __gnu_parallel::sort(keyed.begin(), keyed.end());
+            } else {
+                std::sort(keyed.begin(), keyed.end());
+            }
+            for (ull j = first; j < last; ++j) {
+                sa[j] = static_cast<uint32_t>(keyed[j - first]);
+                split[j] = j == first || (keyed[j - first] >> 32) != (keyed[j - first - 1] >> 32);
+            }
+        };
+        // Groups big enough to keep every thread busy are sorted one at a time with a parallel
+        // sort, the rest are spread over the threads
+        ull large = std::max<ull>(1 << 16, n / (4 * threads));
+        for (const auto& group : groups) {
+            if (group.second - group.first >= large) {
+                sort_group(group.first, group.second, true);
+            }
+        }
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (size_t g = 0; g < groups.size(); ++g) {
+            if (groups[g].second - groups[g].first < large) {
+                sort_group(groups[g].first, groups[g].second, false);
+            }
+        }
+
+        // Pass 2: new ranks from the split marks; sub-groups that are still tied go to the next round
+        std::vector<std::vector<std::pair<ull, ull>>> next(threads);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (size_t g = 0; g < groups.size(); ++g) {
+            auto& tied = next[omp_get_thread_num()];
+            ull sub = groups[g].first;
+            for (ull j = groups[g].first; j <= groups[g].second; ++j) {
+                if (j == groups[g].second || (j > sub && split[j])) {
+                    if (j - sub > 1) {
+                        tied.push_back({sub, j});
+                    }
+                    sub = j;
+                }
+                if (j < groups[g].second) {
+                    rank[sa[j]] = static_cast<uint32_t>(sub + 1);
+                }
+            }
+        }
+        groups.clear();
+        for (const auto& tied : next) {
+            groups.insert(groups.end(), tied.begin(), tied.end());
+        }
+    }
+    return sa;
+}
+
+// Length of the common prefix of `pattern` and the suffix at `pos`, starting the comparison at
+// `from`; `less` tells whether the suffix sorts before the pattern (a suffix that is a proper
+// prefix of the pattern sorts before it)
+inline ull compare_suffix(std::string_view text, uint32_t pos, std::string_view pattern, ull from, bool& less) {
+    ull lcp = from;
+    ull available = text.size() - pos;
+    while (lcp < pattern.size() && lcp < available && text[pos + lcp] == pattern[lcp]) {
+        lcp++;
+    }
+    if (lcp == pattern.size()) {
+        less = false;
+    } else {
+        less = lcp == available || static_cast<unsigned char>(text[pos + lcp]) < static_cast<unsigned char>(pattern[lcp]);
+    }
+    return lcp;
+}
+
+// SA interval [first, last) of the suffixes that start with `pattern`
+inline std::pair<ull, ull> find_interval(std::string_view text, const uint32_t* sa, std::string_view pattern) {
+    ull n = text.size();
+    if (pattern.empty() || pattern.size() > n) {
+        return {0, 0};
+    }
+    // Lower bound: first suffix not less than the pattern. lcp_low / lcp_high are the common
+    // prefixes of the pattern with the suffixes just outside the current range
+    ull low = 0, high = n, lcp_low = 0, lcp_high = 0;
+    while (low < high) {
+        ull mid = low + (high - low) / 2;
+        bool less;
+        ull lcp = compare_suffix(text, sa[mid], pattern, std::min(lcp_low, lcp_high), less);
+        if (less) {
+            low = mid + 1;
+            lcp_low = lcp;
+        } else {
+            high = mid;
+            lcp_high = lcp;
+        }
+    }
+    ull first = low;
+    // Upper bound: first suffix at or after `first` that does not start with the pattern
+    high = n;
+    lcp_low = lcp_high = 0;
+    while (low < high) {
+        ull mid = low + (high - low) / 2;
+        bool less;
+        ull lcp = compare_suffix(text, sa[mid], pattern, std::min(lcp_low, lcp_high), less);
+        if (lcp == pattern.size()) {
+            low = mid + 1;
+            lcp_low = lcp;
+        } else {
+            high = mid;
+            lcp_high = lcp;
+        }
+    }
+    return {first, low};
+}
+
+const char INDEX_MAGIC[8] = {'P', 'S', 'M', 'I', 'D', 'X', '1', '\0'};
+
+struct IndexHeader {
+    char magic[8];
+    ull text_size;      // newline-stripped bytes
+    ull source_size;    // size and modification time of the document the index was built from
+    ull source_mtime_ns;
+};
+
+inline ull sa_offset(ull text_size) {
+    return (sizeof(IndexHeader) + text_size + 7) / 8 * 8;
+}
+
+// Writes the index to `path` (through a temporary file, so a reader never sees half an index);
+// returns the number of bytes written, 0 on error
+inline ull save_index(const std::string& path, const IndexHeader& header, std::string_view text, const std::vector<uint32_t>& sa) {
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file: " << temporary << std::endl;
+        return 0;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(text.data(), text.size());
+    std::string padding(sa_offset(text.size()) - sizeof(header) - text.size(), '\0');
+    file.write(padding.data(), padding.size());
+    file.write(reinterpret_cast<const char*>(sa.data()), sa.size() * sizeof(uint32_t));
+    file.close();
+    if (!file || rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error writing file: " << path << std::endl;
+        unlink(temporary.c_str());
+        return 0;
+    }
+    return sa_offset(text.size()) + sa.size() * sizeof(uint32_t);
+}
+
+// Read-only mapping of an index file
+class MappedIndex {
+public:
+    MappedIndex() = default;
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+
+    ~MappedIndex() {
+        close();
+    }
+
+    // Fails (quietly) on a missing, truncated or foreign file
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || static_cast<ull>(st.st_size) < sizeof(IndexHeader)) {
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<const char*>(p);
+        size_ = st.st_size;
+        const IndexHeader& h = header();
+        if (std::memcmp(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+            size_ != sa_offset(h.text_size) + h.text_size * sizeof(uint32_t)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const IndexHeader& header() const { return *reinterpret_cast<const IndexHeader*>(data_); }
+    std::string_view text() const { return std::string_view(data_ + sizeof(IndexHeader), header().text_size); }
+    const uint32_t* sa() const { return reinterpret_cast<const uint32_t*>(data_ + sa_offset(header().text_size)); }
+    ull file_size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    ull size_ = 0;
+};
+
+#endif // SUFFIX_ARRAY_H
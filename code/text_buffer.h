@@ -0,0 +1,102 @@
+#ifndef TEXT_BUFFER_H
+#define TEXT_BUFFER_H
+
+// Large read-only input buffers. The memory is mapped without being touched, so the thread that
+// later scans a chunk can be the one that faults it in (first-touch NUMA placement) instead of
+// the single thread that used to read the whole file. The mapping uses huge pages when available.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include "huge_pages.h"
+#include "metrics.h"
+
+typedef unsigned long long ull;
+
+class TextBuffer {
+public:
+    TextBuffer() = default;
+    TextBuffer(const TextBuffer&) = delete;
+    TextBuffer& operator=(const TextBuffer&) = delete;
+
+    ~TextBuffer() {
+        release();
+    }
+
+    bool allocate(size_t size, HugePagePolicy policy = HUGE_2M) {
+        release();
+        if (size == 0) {
+            return true;
+        }
+        mapping_ = map_memory(size, policy);
+        return mapping_.data != nullptr;
+    }
+
+    void release() {
+        unmap_memory(mapping_);
+    }
+
+    char* data() { return mapping_.data; }
+    size_t size() const { return mapping_.size; }
+    std::string_view view() const { return std::string_view(mapping_.data, mapping_.size); }
+    const Mapping& mapping() const { return mapping_; }
+
+private:
+    Mapping mapping_;
+};
+
+// Reads `filename` into `buffer` as num_threads slices [t * chunk, (t + 1) * chunk) where chunk =
+// size / num_threads (the last slice also takes the tail); with a full team, thread t reads and
+// thereby first-touches slice t. The slices are a static worksharing loop, so every one is read
+// even if the runtime grants fewer threads (OMP_DYNAMIC, OMP_THREAD_LIMIT). A scan keeps the pages node-local only if thread t then scans about
+// that slice (a static split); dynamically taken tasks land anywhere. With `metrics`, every
+// thread's read time goes to its IO_NS slot
+inline bool read_file_first_touch(const std::string& filename, TextBuffer& buffer, ull num_threads, HugePagePolicy policy = HUGE_2M,
+                                  Metrics* metrics = nullptr) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    ull size = st.st_size;
+    if (!buffer.allocate(size, policy)) {
+        std::cerr << "Error allocating " << size << " bytes for " << filename << std::endl;
+        close(fd);
+        return false;
+    }
+
+    std::atomic<bool> ok(true);
+    ull chunk_size = size / num_threads;
+    #pragma omp parallel for schedule(static) num_threads(num_threads)
+    for (ull t = 0; t < num_threads; ++t) {
+        auto read_start = metrics != nullptr ? metrics->now() : std::chrono::steady_clock::time_point();
+        ull start = t * chunk_size;
+        ull end = (t == num_threads - 1) ? size : start + chunk_size;
+        while (start < end) {
+            ssize_t n = pread(fd, buffer.data() + start, end - start, start);
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            start += n;
+        }
+        if (metrics != nullptr) {
+            metrics->add(omp_get_thread_num(), IO_NS, metrics->elapsed_ns(read_start));
+        }
+    }
+    close(fd);
+    if (!ok) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+    }
+    return ok;
+}
+
+#endif // TEXT_BUFFER_H
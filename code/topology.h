@@ -0,0 +1,177 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+// CPU / NUMA topology from sysfs and SMT-aware thread pinning for the OpenMP team.
+// Deliberately libnuma-free: placement relies on first touch by pinned threads.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+#include <cctype>
+#include <sched.h>
+#include <omp.h>
+
+struct CpuInfo {
+    int cpu;
+    int core;    // physical core id within the package
+    int package; // socket
+    int node;    // NUMA node
+    int smt;     // 0 for the first hardware thread of a core, 1 for its sibling, ...
+};
+
+inline int read_sysfs_int(const std::string& path, int default_value) {
+    std::ifstream file(path);
+    int value;
+    return (file >> value) ? value : default_value;
+}
+
+// Parses "0-3,8,10-11" style lists
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    for (std::string range; std::getline(ss, range, ',');) {
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int c = first; c <= last; ++c) {
+            cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+
+inline std::vector<CpuInfo> read_topology() {
+    std::vector<CpuInfo> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::vector<int> node_of(CPU_SETSIZE, 0);
+    for (int node = 0; node < 1024; ++node) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file.is_open()) {
+            if (node > 0) break;
+            continue;
+        }
+        std::string list;
+        std::getline(file, list);
+        for (int cpu : parse_cpu_list(list)) {
+            if (cpu < CPU_SETSIZE) node_of[cpu] = node;
+        }
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        cpus.push_back({cpu, read_sysfs_int(base + "core_id", cpu), read_sysfs_int(base + "physical_package_id", 0), node_of[cpu], 0});
+    }
+
+    // Number the hardware threads of each physical core
+    for (auto& info : cpus) {
+        for (const auto& other : cpus) {
+            if (other.cpu < info.cpu && other.core == info.core && other.package == info.package) {
+                info.smt++;
+            }
+        }
+    }
+    return cpus;
+}
+
+inline int node_count(const std::vector<CpuInfo>& cpus) {
+    int nodes = 1;
+    for (const auto& info : cpus) {
+        nodes = std::max(nodes, info.node + 1);
+    }
+    return nodes;
+}
+
+inline int node_of_cpu(const std::vector<CpuInfo>& cpus, int cpu) {
+    for (const auto& info : cpus) {
+        if (info.cpu == cpu) {
+            return info.node;
+        }
+    }
+    return 0;
+}
+
+// CPU order for a pinning policy:
+//   compact  fill one node after the other, SMT siblings next to each other
+//   scatter  round-robin over nodes, every physical core before any SMT sibling
+//   cores    like compact but one hardware thread per physical core (no SMT sharing)
+//   a,b,c    an explicit CPU list ("0-7,16-23" syntax)
+// Returns an empty list for "none" or an unknown policy.
+inline std::vector<int> pin_order(const std::vector<CpuInfo>& cpus, const std::string& policy) {
+    std::vector<CpuInfo> sorted = cpus;
+    if (policy == "compact" || policy == "cores") {
+        std::sort(sorted.begin(), sorted.end(), [](const CpuInfo& a, const CpuInfo& b) {
+            return std::tie(a.node, a.package, a.core, a.smt) < std::tie(b.node, b.package, b.core, b.smt);
+        });
+        if (policy == "cores") {
+            sorted.erase(std::remove_if(sorted.begin(), sorted.end(), [](const CpuInfo& c) { return c.smt > 0; }), sorted.end());
+        }
+    } else if (policy == "scatter") {
+        // rank inside (node, smt level) first, so that consecutive threads alternate nodes
+        std::vector<int> rank(sorted.size(), 0);
+        std::sort(sorted.begin(), sorted.end(), [](const CpuInfo& a, const CpuInfo& b) {
+            return std::tie(a.smt, a.node, a.package, a.core) < std::tie(b.smt, b.node, b.package, b.core);
+        });
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (sorted[j].smt == sorted[i].smt && sorted[j].node == sorted[i].node) rank[i]++;
+            }
+        }
+        std::vector<size_t> index(sorted.size());
+        for (size_t i = 0; i < index.size(); ++i) index[i] = i;
+        std::stable_sort(index.begin(), index.end(), [&](size_t a, size_t b) {
+            return std::tie(sorted[a].smt, rank[a]) < std::tie(sorted[b].smt, rank[b]);
+        });
+        std::vector<CpuInfo> scattered;
+        for (size_t i : index) scattered.push_back(sorted[i]);
+        sorted = scattered;
+    } else if (!policy.empty() && policy != "none" && std::isdigit(static_cast<unsigned char>(policy[0]))) {
+        return parse_cpu_list(policy);
+    } else {
+        if (!policy.empty() && policy != "none") {
+            std::cerr << "Unknown pinning policy: " << policy << std::endl;
+        }
+        return {};
+    }
+    std::vector<int> order;
+    for (const auto& info : sorted) {
+        order.push_back(info.cpu);
+    }
+    return order;
+}
+
+// Pins OpenMP thread t of a num_threads team to order[t % order.size()]; the team must be
+// re-created with the same size afterwards so the same OS threads are reused.
+// Returns the CPU each thread runs on after pinning.
+inline std::vector<int> pin_threads(const std::vector<int>& order, int num_threads) {
+    std::vector<int> cpu_of(num_threads, -1);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int t = omp_get_thread_num();
+        if (!order.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(order[t % order.size()], &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                #pragma omp critical
+                std::cerr << "Cannot pin thread " << t << " to CPU " << order[t % order.size()] << std::endl;
+            }
+        }
+        cpu_of[t] = sched_getcpu();
+    }
+    return cpu_of;
+}
+
+#endif // TOPOLOGY_H
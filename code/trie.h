@@ -0,0 +1,320 @@
+#ifndef TRIE_H
+#define TRIE_H
+
+// Trie shared by the trie engines. Nodes are rows of one flat transition table:
+//   next(node, c) == table[node * stride + classes[c]]
+// with 32-bit node indices instead of pointers. By default every byte is its own class
+// (stride 256); set_alphabet() maps the bytes that never occur in a pattern to one dead column,
+// so a row only has (distinct pattern bytes + 1) entries. Node 0 is the root and is never anybody's child,
+// so 0 doubles as "no transition". Allocating a node bumps the row count, the table doubles when
+// full, and the whole structure goes away with a single munmap (clear() / destructor) instead of
+// one delete per node.
+//
+// Identical patterns share one terminal node: the first index inserted for a string is its
+// canonical index, the only one the automaton ever reports, and later duplicates are chained
+// behind it, so scan work depends on the distinct patterns only and every duplicate can still be
+// answered (canonical(), for_each_duplicate()).
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "huge_pages.h"
+#include "perf_counters.h"
+
+typedef unsigned long long ull;
+
+class Trie {
+public:
+    static constexpr ull NO_PATTERN = static_cast<ull>(-1);
+
+    explicit Trie(HugePagePolicy policy = HUGE_2M) : policy_(policy) {
+        for (int c = 0; c < 256; ++c) {
+            classes_[c] = static_cast<uint16_t>(c);
+        }
+        clear();
+    }
+    Trie(const Trie&) = delete;
+    Trie& operator=(const Trie&) = delete;
+    Trie(Trie&& other) noexcept { *this = std::move(other); }
+    Trie& operator=(Trie&& other) noexcept {
+        if (this != &other) {
+            unmap_memory(table_);
+            policy_ = other.policy_;
+            std::memcpy(classes_, other.classes_, sizeof(classes_));
+            stride_ = other.stride_;
+            table_ = other.table_;
+            nodes_ = other.nodes_;
+            capacity_ = other.capacity_;
+            pattern_ = std::move(other.pattern_);
+            canonical_ = std::move(other.canonical_);
+            next_duplicate_ = std::move(other.next_duplicate_);
+            distinct_ = other.distinct_;
+            other.table_ = Mapping();
+            other.nodes_ = other.capacity_ = 0;
+            other.pattern_.clear();
+            other.distinct_ = 0;
+        }
+        return *this;
+    }
+
+    ~Trie() {
+        unmap_memory(table_);
+    }
+
+    // Drops every pattern and returns the memory; the trie is left with just the root
+    void clear() {
+        unmap_memory(table_);
+        nodes_ = capacity_ = 0;
+        pattern_.clear();
+        canonical_.clear();
+        next_duplicate_.clear();
+        distinct_ = 0;
+        reserve(1);
+        nodes_ = 1;
+        pattern_.push_back(NO_PATTERN);
+    }
+
+    // Restricts the alphabet to the bytes occurring in `patterns`; clears the trie, so it is called
+    // before the first insert, with (at least) every pattern that will be inserted. Patterns that
+    // use all 256 byte values keep the full alphabet, as the dead column would only widen rows
+    void set_alphabet(const std::vector<std::string>& patterns) {
+        bool used[256] = {};
+        int distinct = 0;
+        for (const auto& pattern : patterns) {
+            for (char ch : pattern) {
+                distinct += !used[static_cast<unsigned char>(ch)];
+                used[static_cast<unsigned char>(ch)] = true;
+            }
+        }
+        stride_ = distinct == 256 ? 0 : 1; // column 0 collects every byte that no pattern contains
+        for (int c = 0; c < 256; ++c) {
+            classes_[c] = used[c] ? static_cast<uint16_t>(stride_++) : 0;
+        }
+        clear();
+    }
+
+    // Makes room for `nodes` nodes in total, e.g. the summed pattern length + 1 before a bulk build;
+    // the table is sized in whole 2 MB units so that it can always be backed by huge pages
+    void reserve(size_t nodes) {
+        if (nodes <= capacity_) {
+            return;
+        }
+        Mapping grown = map_memory(round_up(nodes * row_bytes(), HUGE_2M_SIZE), policy_);
+        if (grown.data == nullptr) {
+            throw std::bad_alloc();
+        }
+        if (nodes_ > 0) {
+            std::memcpy(grown.data, table_.data, nodes_ * row_bytes());
+        }
+        unmap_memory(table_);
+        table_ = grown;
+        capacity_ = grown.size / row_bytes();
+        pattern_.reserve(capacity_);
+    }
+
+    void insert(const std::string& pattern, ull patternIndex) {
+        PERF_SCOPE("build");
+        uint32_t node = 0;
+        for (char ch : pattern) {
+            uint16_t c = classes_[static_cast<unsigned char>(ch)];
+            uint32_t& child = row(node)[c];
+            if (child == 0) {
+                uint32_t created = new_node();
+                // new_node() may have moved the table, so the reference is re-taken
+                row(node)[c] = created;
+                node = created;
+            } else {
+                node = child;
+            }
+        }
+        if (canonical_.size() <= patternIndex) {
+            canonical_.resize(patternIndex + 1, NO_PATTERN);
+            next_duplicate_.resize(patternIndex + 1, NO_PATTERN);
+        }
+        if (pattern_[node] == NO_PATTERN) {
+            pattern_[node] = patternIndex;
+            canonical_[patternIndex] = patternIndex;
+            distinct_++;
+            return;
+        }
+        // Duplicate: linked in right behind the canonical index
+        ull first = pattern_[node];
+        next_duplicate_[patternIndex] = next_duplicate_[first];
+        next_duplicate_[first] = patternIndex;
+        canonical_[patternIndex] = first;
+    }
+
+    // Inserts patterns[i] with index i for every i (empty ones only with skip_empty false), with the
+    // same paths, canonical indices and duplicate chains as inserting them in index order, but built
+    // on num_threads threads: the patterns are split by first byte into one contiguous class range
+    // per thread, each range goes into a private trie, and the private tries are then copied in
+    // behind the root side by side with their node numbers shifted. Node numbering differs from
+    // serial insertion. Falls back to insert() on a non-empty trie or a small pattern set
+    void insert_all(const std::vector<std::string>& patterns, ull num_threads, bool skip_empty = false) {
+        std::vector<std::vector<ull>> by_class(stride_);
+        ull total_bytes = 0;
+        for (ull i = 0; i < patterns.size(); ++i) {
+            if (!patterns[i].empty()) {
+                by_class[classes_[static_cast<unsigned char>(patterns[i][0])]].push_back(i);
+                total_bytes += patterns[i].size();
+            }
+        }
+        if (nodes_ > 1 || num_threads <= 1 || total_bytes < (64 << 10)) {
+            for (ull i = 0; i < patterns.size(); ++i) {
+                if (!skip_empty || !patterns[i].empty()) {
+                    insert(patterns[i], i);
+                }
+            }
+            return;
+        }
+
+        // Contiguous class ranges of about total_bytes / num_threads bytes each
+        std::vector<size_t> cuts = {0};
+        ull bytes = 0;
+        for (size_t cls = 0; cls < stride_; ++cls) {
+            for (ull i : by_class[cls]) {
+                bytes += patterns[i].size();
+            }
+            if (bytes * num_threads >= total_bytes * cuts.size() && cuts.size() < num_threads) {
+                cuts.push_back(cls + 1);
+            }
+        }
+        cuts.push_back(stride_);
+        size_t parts = cuts.size() - 1;
+
+        // Every part numbers its patterns locally (ascending global index, so canonical indices
+        // and duplicate chains come out as with serial insertion)
+        std::vector<Trie> tries(parts);
+        std::vector<std::vector<ull>> ids(parts);
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+        for (size_t p = 0; p < parts; ++p) {
+            for (size_t cls = cuts[p]; cls < cuts[p + 1]; ++cls) {
+                ids[p].insert(ids[p].end(), by_class[cls].begin(), by_class[cls].end());
+            }
+            std::sort(ids[p].begin(), ids[p].end());
+            Trie& part = tries[p];
+            part.policy_ = policy_;
+            std::memcpy(part.classes_, classes_, sizeof(classes_));
+            part.stride_ = stride_;
+            part.clear();
+            for (ull j = 0; j < ids[p].size(); ++j) {
+                part.insert(patterns[ids[p][j]], j);
+            }
+        }
+
+        // Part p's node k > 0 becomes node base[p] + k - 1; its root row fills the columns of its range
+        std::vector<size_t> base(parts + 1, 1);
+        for (size_t p = 0; p < parts; ++p) {
+            base[p + 1] = base[p] + tries[p].nodes_ - 1;
+        }
+        reserve(base[parts]);
+        pattern_.resize(base[parts], NO_PATTERN);
+        canonical_.assign(patterns.size(), NO_PATTERN);
+        next_duplicate_.assign(patterns.size(), NO_PATTERN);
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+        for (size_t p = 0; p < parts; ++p) {
+            PERF_SCOPE("build"); // the private tries were timed by insert()
+            const Trie& part = tries[p];
+            uint32_t shift = static_cast<uint32_t>(base[p] - 1);
+            for (size_t k = 0; k < part.nodes_; ++k) {
+                const uint32_t* from = part.table() + k * stride_;
+                uint32_t* to = row(k == 0 ? 0 : static_cast<uint32_t>(k + shift));
+                for (size_t cls = k == 0 ? cuts[p] : 0; cls < (k == 0 ? cuts[p + 1] : stride_); ++cls) {
+                    to[cls] = from[cls] == 0 ? 0 : from[cls] + shift;
+                }
+                if (k > 0 && part.pattern_[k] != NO_PATTERN) {
+                    pattern_[k + shift] = ids[p][part.pattern_[k]];
+                }
+            }
+            for (ull j = 0; j < ids[p].size(); ++j) {
+                canonical_[ids[p][j]] = ids[p][part.canonical_[j]];
+                if (part.next_duplicate_[j] != NO_PATTERN) {
+                    next_duplicate_[ids[p][j]] = ids[p][part.next_duplicate_[j]];
+                }
+            }
+        }
+        nodes_ = base[parts];
+        for (size_t p = 0; p < parts; ++p) {
+            distinct_ += tries[p].distinct_;
+        }
+        for (ull i = 0; i < patterns.size(); ++i) {
+            if (!skip_empty && patterns[i].empty()) {
+                insert(patterns[i], i);
+            }
+        }
+    }
+
+    // Copy of the whole trie in a fresh mapping; the calling thread first-touches it, which is
+    // how the NUMA replicas are placed
+    Trie clone() const {
+        Trie copy(policy_);
+        std::memcpy(copy.classes_, classes_, sizeof(classes_));
+        copy.stride_ = stride_;
+        copy.clear();
+        copy.reserve(nodes_);
+        std::memcpy(copy.table_.data, table_.data, nodes_ * row_bytes());
+        copy.nodes_ = nodes_;
+        copy.pattern_ = pattern_;
+        copy.canonical_ = canonical_;
+        copy.next_duplicate_ = next_duplicate_;
+        copy.distinct_ = distinct_;
+        return copy;
+    }
+
+    uint32_t root() const { return 0; }
+    // Child of `node` on byte c, 0 if there is none
+    uint32_t next(uint32_t node, unsigned char c) const { return table()[static_cast<size_t>(node) * stride_ + classes_[c]]; }
+    // Child of `node` on column `cls` (see byte_class), 0 if there is none
+    uint32_t child(uint32_t node, size_t cls) const { return table()[static_cast<size_t>(node) * stride_ + cls]; }
+    uint16_t byte_class(unsigned char c) const { return classes_[c]; }
+    // Canonical index of the pattern ending at `node`, NO_PATTERN if none does
+    ull pattern(uint32_t node) const { return pattern_[node]; }
+    // Canonical index of an inserted pattern index (itself unless it duplicates an earlier one)
+    ull canonical(ull patternIndex) const { return patternIndex < canonical_.size() ? canonical_[patternIndex] : NO_PATTERN; }
+    // Calls f(index) for a canonical index and every other index inserted with the same string
+    template <typename F>
+    void for_each_duplicate(ull canonical, F f) const {
+        for (ull i = canonical; i != NO_PATTERN; i = next_duplicate_[i]) {
+            f(i);
+        }
+    }
+    size_t distinct_patterns() const { return distinct_; }
+
+    size_t node_count() const { return nodes_; }
+    // Row width: 256 for the full alphabet, distinct pattern bytes + 1 after set_alphabet() (also
+    // 256 for 255 distinct bytes, so a width of 256 does not mean byte_class(c) == c)
+    size_t byte_classes() const { return stride_; }
+    size_t memory_bytes() const { return table_.mapped + pattern_.capacity() * sizeof(ull); }
+    const Mapping& mapping() const { return table_; }
+
+private:
+    size_t row_bytes() const { return stride_ * sizeof(uint32_t); }
+    const uint32_t* table() const { return reinterpret_cast<const uint32_t*>(table_.data); }
+    uint32_t* row(uint32_t node) { return reinterpret_cast<uint32_t*>(table_.data) + static_cast<size_t>(node) * stride_; }
+
+    // Rows past nodes_ are still zero from the anonymous mapping, so a new node needs no clearing
+    uint32_t new_node() {
+        if (nodes_ == capacity_) {
+            reserve(capacity_ * 2);
+        }
+        pattern_.push_back(NO_PATTERN);
+        return static_cast<uint32_t>(nodes_++);
+    }
+
+    HugePagePolicy policy_;
+    uint16_t classes_[256];
+    size_t stride_ = 256;
+    Mapping table_;
+    size_t nodes_ = 0;
+    size_t capacity_ = 0;
+    std::vector<ull> pattern_;        // per node
+    std::vector<ull> canonical_;      // per pattern index
+    std::vector<ull> next_duplicate_; // per pattern index, NO_PATTERN ends the chain
+    size_t distinct_ = 0;
+};
+
+#endif // TRIE_H
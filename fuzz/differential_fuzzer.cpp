@@ -0,0 +1,69 @@
+// libFuzzer entry point for the differential oracle: every input is decoded into a document and an
+// antivirus case, all engine binaries are run on it and any disagreement with the reference aborts.
+//
+//   make fuzz && ./differential_fuzzer -max_len=4096
+//
+// ENGINE_BIN_DIR selects where the engine binaries live (default: current directory) and
+// FUZZ_THREADS the OpenMP thread counts to try (default: 1,3). Building with -DFUZZ_STANDALONE
+// (make fuzz_standalone) replaces libFuzzer by a driver that replays the files given on the command line.
+
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+#include "../code/oracle.h"
+
+static fs::path fuzz_work_dir() {
+    static fs::path dir;
+    if (dir.empty()) {
+        char pattern[] = "/tmp/differential_fuzzer_XXXXXX";
+        if (mkdtemp(pattern) == nullptr) {
+            std::abort();
+        }
+        dir = pattern;
+    }
+    return dir;
+}
+
+static std::vector<int> fuzz_thread_counts() {
+    std::vector<int> counts;
+    std::stringstream list(std::getenv("FUZZ_THREADS") ? std::getenv("FUZZ_THREADS") : "1,3");
+    for (std::string t; std::getline(list, t, ',');) {
+        counts.push_back(std::max(1, std::atoi(t.c_str())));
+    }
+    return counts;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static const fs::path bin_dir = fs::absolute(std::getenv("ENGINE_BIN_DIR") ? std::getenv("ENGINE_BIN_DIR") : ".");
+    static const std::vector<int> thread_counts = fuzz_thread_counts();
+
+    // antivirus_embedded would be compiled for every input; differential_check covers it
+    static const std::vector<Engine> engines = [] {
+        std::vector<Engine> selected;
+        for (const auto& engine : all_engines()) {
+            if (engine.scenario != EMBEDDED) {
+                selected.push_back(engine);
+            }
+        }
+        return selected;
+    }();
+
+    TestCase tc = decode_case(data, size);
+    if (check_case(tc, bin_dir, fuzz_work_dir(), engines, thread_counts, std::cerr) != 0) {
+        std::abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+        std::cout << argv[i] << ": OK" << std::endl;
+    }
+    fs::remove_all(fuzz_work_dir());
+    return 0;
+}
+#endif